@@ -0,0 +1,67 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Counts allocations by standing in for malloc() and friends: glib calls
+ * them through the PLT, so linking this in is enough to see everything.
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include "alloc.h"
+
+static gsize _count;
+static gsize _bytes;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void *ptr, size_t size);
+
+static void _add(gsize size)
+{
+	g_atomic_pointer_add(&_count, 1);
+	g_atomic_pointer_add(&_bytes, size);
+}
+
+void* malloc(size_t size)
+{
+	_add(size);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+	_add(n * size);
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void *ptr, size_t size)
+{
+	_add(size);
+	return __libc_realloc(ptr, size);
+}
+
+gsize alloc_count(void)
+{
+	return (gsize)g_atomic_pointer_get(&_count);
+}
+
+gsize alloc_bytes(void)
+{
+	return (gsize)g_atomic_pointer_get(&_bytes);
+}
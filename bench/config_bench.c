@@ -0,0 +1,471 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs config.c against generated config dirs of growing size. Each load
+ * happens in its own process, since config.c only starts once, and so that
+ * peak RSS means something. Reloads go through the real path: inotify, the
+ * worker and the swap on the main loop; only the debounce is skipped.
+ *
+ * Allocations include everything glib does on config's behalf; see alloc.c.
+ */
+
+#include <glib.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "callbacks.h"
+#include "config.h"
+#include "keys.h"
+#include "poll_stub.h"
+#include "state.h"
+
+#define INDENT "    "
+
+/**
+ * Programs are spread over files of this many each
+ */
+#define PROGS_PER_FILE 50
+
+struct _result {
+	gint64 wall;
+	gsize allocs;
+	gsize bytes;
+	glong rss;
+};
+
+enum _phase {
+	phase_cold,
+	phase_start,
+	phase_reload_one,
+	phase_reload_all,
+	phase_warm,
+	phase_dump,
+	phase_count,
+};
+
+static const char *_phase_names[] = {
+	"cold load",
+	"prog start",
+	"reload one",
+	"reload all",
+	"warm load",
+	"dump",
+};
+
+static const char *_mods[] = {
+	"ctrl",
+	"shift",
+	"alt",
+};
+
+static const char *_keys[] = {
+	"a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+	"n", "o", "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+	"1", "2", "3", "4", "5", "6", "7", "8", "9", "0",
+	"f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8", "f9", "f10",
+	"space", "tab", "esc", "enter",
+};
+
+static gboolean _updated;
+
+/**
+ * Where a child sends its results
+ */
+static int _out = -1;
+
+static struct _result _start;
+
+void cbs_config_updated(void)
+{
+	_updated = TRUE;
+}
+
+static glong _rss(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static void _begin(void)
+{
+	_start.wall = g_get_monotonic_time();
+	_start.allocs = alloc_count();
+	_start.bytes = alloc_bytes();
+}
+
+/**
+ * Send what happened since _begin() back to the parent
+ */
+static void _end(enum _phase phase)
+{
+	struct _result res = {
+		.wall = g_get_monotonic_time() - _start.wall,
+		.allocs = alloc_count() - _start.allocs,
+		.bytes = alloc_bytes() - _start.bytes,
+		.rss = _rss(),
+	};
+	guint8 p = phase;
+
+	if (write(_out, &p, sizeof(p)) != sizeof(p) ||
+		write(_out, &res, sizeof(res)) != sizeof(res)) {
+		_exit(1);
+	}
+}
+
+static void _end_dump(void)
+{
+	_end(phase_dump);
+}
+
+/**
+ * Run the main loop until config swaps in a new generation. The debounce
+ * timer fires as soon as nothing else is ready.
+ */
+static void _wait_updated(void)
+{
+	guint i;
+	gint64 due;
+	struct poll_timer *t;
+	struct pollfd fds[8];
+	guint nfds = MIN(poll_stub_count(), G_N_ELEMENTS(fds));
+
+	_updated = FALSE;
+
+	while (!_updated) {
+		int ready;
+
+		for (i = 0; i < nfds; i++) {
+			fds[i].fd = poll_stub_fd(i);
+			fds[i].events = POLLIN;
+		}
+
+		t = poll_stub_next_timer(&due);
+		ready = poll(fds, nfds, t == NULL ? -1 : 0);
+
+		if (ready == 0 && t != NULL) {
+			poll_stub_fire_timer(t);
+			continue;
+		}
+
+		for (i = 0; i < nfds; i++) {
+			if (fds[i].revents & POLLIN) {
+				poll_stub_fire(fds[i].fd);
+			}
+		}
+	}
+}
+
+static char* _file_path(const char *dir, guint file)
+{
+	return g_strdup_printf("%s/progs-%04u.ini", dir, file);
+}
+
+/**
+ * Change a file without changing what it configures
+ */
+static void _touch(const char *dir, guint file)
+{
+	char *path = _file_path(dir, file);
+	FILE *f = fopen(path, "a");
+
+	if (f == NULL) {
+		g_error("failed to open %s", path);
+	}
+
+	fprintf(f, "# touched\n");
+	fclose(f);
+	g_free(path);
+}
+
+static void _combo(GString *s, GRand *r)
+{
+	guint i;
+	guint mods = g_rand_int_range(r, 0, G_N_ELEMENTS(_mods) + 1);
+
+	for (i = 0; i < mods; i++) {
+		g_string_append_printf(s, "%s+", _mods[i]);
+	}
+
+	g_string_append(s, _keys[g_rand_int_range(r, 0, G_N_ELEMENTS(_keys))]);
+}
+
+/**
+ * Write a config dir with `progs` programs with `layouts` layouts each.
+ * Returns its total size.
+ */
+static gsize _gen_dir(const char *dir, guint progs, guint layouts)
+{
+	guint i;
+	guint j;
+	guint k;
+	gsize size = 0;
+	GRand *r = g_rand_new_with_seed(progs * 8 + layouts);
+	GString *s = g_string_new("");
+
+	for (i = 0; i < progs; i++) {
+		g_string_append_printf(s,
+			"[prog%05u]\n"
+			"cmd = /usr/games/prog%05u --fullscreen\n"
+			"exe = prog%05u/bin/prog\n",
+			i, i, i);
+
+		for (j = 1; j <= layouts; j++) {
+			g_string_append_printf(s, "\n[prog%05u:%u]\n", i, j);
+
+			for (k = 0; k < G_N_ELEMENTS(((struct layout*)NULL)->combos); k++) {
+				if (g_rand_int_range(r, 0, 4) == 0) {
+					continue;
+				}
+
+				g_string_append_printf(s, "%s = ", keys_get_dev_name(k));
+				_combo(s, r);
+				g_string_append_c(s, '\n');
+			}
+		}
+
+		g_string_append_c(s, '\n');
+
+		if ((i + 1) % PROGS_PER_FILE == 0 || i + 1 == progs) {
+			char *path = _file_path(dir, i / PROGS_PER_FILE);
+
+			if (!g_file_set_contents(path, s->str, s->len, NULL)) {
+				g_error("failed to write %s", path);
+			}
+
+			size += s->len;
+			g_string_truncate(s, 0);
+			g_free(path);
+		}
+	}
+
+	g_string_free(s, TRUE);
+	g_rand_free(r);
+
+	return size;
+}
+
+static void _rm_dir(const char *dir)
+{
+	GDir *d = g_dir_open(dir, 0, NULL);
+	const char *name;
+
+	while (d != NULL && (name = g_dir_read_name(d))) {
+		char *path = g_strdup_printf("%s/%s", dir, name);
+		unlink(path);
+		g_free(path);
+	}
+
+	if (d != NULL) {
+		g_dir_close(d);
+	}
+
+	rmdir(dir);
+}
+
+static void _init(const char *dir, gboolean dump)
+{
+	char prog[] = "config_bench";
+	char dir_opt[] = "-c";
+	char dump_opt[] = "--dump-config";
+	char *d = g_strdup(dir);
+	char *argv[] = { prog, dir_opt, d, dump_opt, NULL };
+
+	optind = 1;
+	cfg_init(dump ? 4 : 3, argv);
+	g_free(d);
+}
+
+/**
+ * Everything that happens in a process that starts without caches
+ */
+static void _run_cold(const char *dir, guint files)
+{
+	guint i;
+
+	_begin();
+	_init(dir, FALSE);
+	_end(phase_cold);
+
+	if (cfg.programs->len > 0) {
+		_begin();
+		state_set_prog(0, getpid());
+		cfg_on_prog_start();
+		_end(phase_start);
+	}
+
+	_touch(dir, 0);
+	_begin();
+	_wait_updated();
+	_end(phase_reload_one);
+
+	for (i = 0; i < files; i++) {
+		_touch(dir, i);
+	}
+
+	_begin();
+	_wait_updated();
+	_end(phase_reload_all);
+}
+
+static void _run_warm(const char *dir, guint files G_GNUC_UNUSED)
+{
+	_begin();
+	_init(dir, FALSE);
+	_end(phase_warm);
+}
+
+static void _run_dump(const char *dir, guint files G_GNUC_UNUSED)
+{
+	if (freopen("/dev/null", "w", stdout) == NULL) {
+		_exit(1);
+	}
+
+	atexit(_end_dump);
+	_begin();
+	_init(dir, TRUE);
+}
+
+/**
+ * Run something in its own process, collecting what it reports
+ */
+static gboolean _fork(
+	void (*run)(const char *dir, guint files),
+	const char *dir,
+	guint files,
+	struct _result *res,
+	gboolean *got)
+{
+	int fds[2];
+	int status;
+	pid_t pid;
+	guint8 phase;
+
+	if (pipe(fds) == -1) {
+		g_error("failed to create pipe");
+	}
+
+	// Or whatever's buffered gets printed again by the child
+	fflush(stdout);
+
+	pid = fork();
+	if (pid == -1) {
+		g_error("failed to fork");
+	}
+
+	if (pid == 0) {
+		close(fds[0]);
+		_out = fds[1];
+		state_init();
+		poll_init();
+		run(dir, files);
+		exit(0);
+	}
+
+	close(fds[1]);
+
+	while (read(fds[0], &phase, sizeof(phase)) == sizeof(phase)) {
+		if (phase >= phase_count ||
+			read(fds[0], &res[phase], sizeof(*res)) != sizeof(*res)) {
+			break;
+		}
+
+		got[phase] = TRUE;
+	}
+
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static gboolean _bench(guint progs, guint layouts)
+{
+	guint i;
+	gsize size;
+	gboolean ok = TRUE;
+	struct _result res[phase_count];
+	gboolean got[phase_count];
+	guint files = (progs + PROGS_PER_FILE - 1) / PROGS_PER_FILE;
+	char *dir = g_dir_make_tmp("lintartarus-bench-XXXXXX", NULL);
+
+	if (dir == NULL) {
+		g_error("failed to create config dir");
+	}
+
+	memset(got, 0, sizeof(got));
+	size = _gen_dir(dir, progs, layouts);
+
+	ok &= _fork(_run_cold, dir, files, res, got);
+	ok &= _fork(_run_warm, dir, files, res, got);
+	ok &= _fork(_run_dump, dir, files, res, got);
+
+	printf(INDENT "%u programs, %u layout%s each (%u files, %.1fKB):\n",
+		progs,
+		layouts,
+		layouts == 1 ? "" : "s",
+		files,
+		size / 1024.0);
+
+	for (i = 0; i < phase_count; i++) {
+		if (!got[i]) {
+			printf(INDENT INDENT "%-10s FAILED\n", _phase_names[i]);
+			ok = FALSE;
+			continue;
+		}
+
+		printf(INDENT INDENT "%-10s %10.2fms %9zu allocs %10.1fKB, "
+			"peak rss %7ldKB\n",
+			_phase_names[i],
+			res[i].wall / 1000.0,
+			res[i].allocs,
+			res[i].bytes / 1024.0,
+			res[i].rss);
+	}
+
+	_rm_dir(dir);
+	g_free(dir);
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	guint i;
+	guint j;
+	gboolean ok = TRUE;
+	const guint progs[] = { 10, 100, 1000, 10000 };
+	const guint layouts[] = { 1, 7 };
+	guint max = argc > 1 ? strtoul(argv[1], NULL, 10) : G_MAXUINT;
+
+	printf("config loads (%u programs per file):\n", PROGS_PER_FILE);
+	for (i = 0; i < G_N_ELEMENTS(progs) && progs[i] <= max; i++) {
+		for (j = 0; j < G_N_ELEMENTS(layouts); j++) {
+			ok &= _bench(progs[i], layouts[j]);
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,367 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times the path a key press takes through lintartarus: layout_key() and
+ * layout_translate() on their own, and input_read() reading events off a
+ * pipe and sending them to a stub keyboard, then again with the tap on.
+ * Events are generated for the programs in the shipped keymaps, the way a
+ * Tartarus reports them: a scan code, the key, and a sync for every press,
+ * repeat and release.
+ */
+
+#include <fcntl.h>
+#include <glib.h>
+#include <linux/input.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "callbacks.h"
+#include "config.h"
+#include "input.h"
+#include "keys.h"
+#include "layout.h"
+#include "poll_stub.h"
+#include "state.h"
+#include "tap.h"
+#include "uinput_stub.h"
+
+#define INDENT "    "
+
+/**
+ * Key presses to generate for each program
+ */
+#define PRESSES 100000
+
+/**
+ * Roughly how many key events to time each thing with
+ */
+#define RUNS 1000000
+
+/**
+ * Events written to the pipe at a time, comfortably less than it holds
+ */
+#define BATCH 1024
+
+static const char *_keymaps[] = {
+	"ksp",
+	"pa",
+	"borderlands",
+};
+
+void cbs_config_updated(void)
+{
+}
+
+void cbs_check_state(void)
+{
+}
+
+void cbs_key_press(void)
+{
+}
+
+static void _copy(const char *from, const char *to, const char *name)
+{
+	char *contents;
+	gsize len;
+	char *src = g_strdup_printf("%s/%s.ini", from, name);
+	char *dst = g_strdup_printf("%s/%s.ini", to, name);
+
+	if (!g_file_get_contents(src, &contents, &len, NULL)) {
+		g_error("failed to read %s", src);
+	}
+
+	if (!g_file_set_contents(dst, contents, len, NULL)) {
+		g_error("failed to write %s", dst);
+	}
+
+	g_free(contents);
+	g_free(src);
+	g_free(dst);
+}
+
+static void _rm_dir(const char *dir)
+{
+	GDir *d = g_dir_open(dir, 0, NULL);
+	const char *name;
+
+	while (d != NULL && (name = g_dir_read_name(d))) {
+		char *path = g_strdup_printf("%s/%s", dir, name);
+		unlink(path);
+		g_free(path);
+	}
+
+	if (d != NULL) {
+		g_dir_close(d);
+	}
+
+	rmdir(dir);
+}
+
+static void _init(const char *keymaps)
+{
+	guint i;
+	char prog[] = "event_bench";
+	char dir_opt[] = "-c";
+	char *dir = g_dir_make_tmp("lintartarus-bench-XXXXXX", NULL);
+	char *argv[] = { prog, dir_opt, dir, NULL };
+
+	if (dir == NULL) {
+		g_error("failed to create config dir");
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(_keymaps); i++) {
+		_copy(keymaps, dir, _keymaps[i]);
+	}
+
+	state_init();
+	poll_init();
+	cfg_init(G_N_ELEMENTS(argv) - 1, argv);
+	layout_init();
+
+	_rm_dir(dir);
+	g_free(dir);
+}
+
+/**
+ * Make the given program the one that's running, on its first layout
+ */
+static gboolean _start(const char *name)
+{
+	guint i;
+
+	for (i = 0; i < cfg.programs->len; i++) {
+		struct program *p = g_ptr_array_index(cfg.programs, i);
+
+		if (g_strcmp0(p->name, name) == 0) {
+			state_set_prog(i, getpid());
+			cfg_on_prog_start();
+			state_set_layout(1);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void _push(GArray *evs, guint16 type, guint16 code, gint32 value)
+{
+	struct input_event ev = {
+		.type = type,
+		.code = code,
+		.value = value,
+	};
+
+	g_array_append_val(evs, ev);
+}
+
+static void _push_key(GArray *evs, guint16 code, gint32 value)
+{
+	_push(evs, EV_MSC, MSC_SCAN, 0x70000 + code);
+	_push(evs, EV_KEY, code, value);
+	_push(evs, EV_SYN, SYN_REPORT, 0);
+}
+
+/**
+ * Presses of random keys on the device, a few of them held long enough to
+ * repeat
+ */
+static GArray* _gen_events(guint seed)
+{
+	guint i;
+	guint j;
+	guint16 code;
+	guint16 codes[G_N_ELEMENTS(((struct layout*)NULL)->combos)];
+	GRand *r = g_rand_new_with_seed(seed);
+	GArray *evs = g_array_new(FALSE, FALSE, sizeof(struct input_event));
+
+	for (i = 0; i < G_N_ELEMENTS(codes); i++) {
+		codes[i] = keys_code(keys_get_dev_default(i));
+	}
+
+	for (i = 0; i < PRESSES; i++) {
+		code = codes[g_rand_int_range(r, 0, G_N_ELEMENTS(codes))];
+
+		_push_key(evs, code, 1);
+
+		if (g_rand_int_range(r, 0, 10) == 0) {
+			for (j = g_rand_int_range(r, 1, 8); j > 0; j--) {
+				_push_key(evs, code, 2);
+			}
+		}
+
+		_push_key(evs, code, 0);
+	}
+
+	g_rand_free(r);
+
+	return evs;
+}
+
+static void _translate(GArray *evs)
+{
+	guint i;
+	guint j;
+	gsize allocs;
+	gint64 start;
+	gint64 elapsed;
+	guint hits = 0;
+	GArray *codes = g_array_new(FALSE, FALSE, sizeof(int));
+	guint runs;
+	guint n;
+
+	for (i = 0; i < evs->len; i++) {
+		struct input_event *ev = &g_array_index(evs, struct input_event, i);
+		if (ev->type == EV_KEY) {
+			int code = ev->code;
+			g_array_append_val(codes, code);
+		}
+	}
+
+	runs = MAX(1, RUNS / codes->len);
+	n = runs * codes->len;
+
+	allocs = alloc_count();
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < runs; i++) {
+		for (j = 0; j < codes->len; j++) {
+			int key = layout_key(g_array_index(codes, int, j));
+			hits += key >= 0 && layout_translate(key) != NULL;
+		}
+	}
+
+	elapsed = g_get_monotonic_time() - start;
+	allocs = alloc_count() - allocs;
+
+	printf(INDENT INDENT "layout_translate: %.1fns/op, %.2f allocs/op, "
+		"%.0f%% mapped\n",
+		elapsed * 1000.0 / n,
+		(gdouble)allocs / n,
+		hits * 100.0 / n);
+
+	g_array_free(codes, TRUE);
+}
+
+static void _dispatch(GArray *evs, const char *what)
+{
+	int fds[2];
+	guint i;
+	guint j;
+	guint k;
+	gsize allocs;
+	gint64 start;
+	gint64 elapsed = 0;
+	guint sent = uinput_stub_sent();
+	guint runs = MAX(1, RUNS / evs->len);
+	guint n = runs * evs->len;
+
+	if (pipe(fds) == -1 ||
+		fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1) {
+		g_error("failed to create pipe");
+	}
+
+	allocs = alloc_count();
+
+	for (i = 0; i < runs; i++) {
+		// Every run sees the same layout changes
+		state_set_layout(1);
+
+		for (j = 0; j < evs->len; j += BATCH) {
+			guint len = MIN(BATCH, evs->len - j);
+			gsize size = len * sizeof(struct input_event);
+
+			if (write(fds[1], &g_array_index(evs, struct input_event, j), size)
+				!= (gssize)size) {
+				g_error("failed to write events");
+			}
+
+			start = g_get_monotonic_time();
+
+			for (k = 0; k < len; k++) {
+				input_read(fds[0], NULL);
+			}
+
+			elapsed += g_get_monotonic_time() - start;
+		}
+	}
+
+	allocs = alloc_count() - allocs;
+	sent = uinput_stub_sent() - sent;
+
+	printf(INDENT INDENT "%-17s %.1fns/op, %.2f allocs/op, "
+		"%.2f keys sent/op\n",
+		what,
+		elapsed * 1000.0 / n,
+		(gdouble)allocs / n,
+		(gdouble)sent / n);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main(int argc, char **argv)
+{
+	guint i;
+	char *tap;
+	gboolean ok = TRUE;
+	GArray *evs[G_N_ELEMENTS(_keymaps)];
+	const char *keymaps = argc > 1 ? argv[1] : "keymaps";
+
+	_init(keymaps);
+	memset(evs, 0, sizeof(evs));
+
+	printf("key events (%u presses per program):\n", PRESSES);
+	for (i = 0; i < G_N_ELEMENTS(_keymaps); i++) {
+		if (!_start(_keymaps[i])) {
+			printf(INDENT "%s: FAILED, not configured\n", _keymaps[i]);
+			ok = FALSE;
+			continue;
+		}
+
+		evs[i] = _gen_events(i);
+
+		printf(INDENT "%s (%u events):\n", _keymaps[i], evs[i]->len);
+		_translate(evs[i]);
+		_dispatch(evs[i], "input_read:");
+	}
+
+	// There's no turning the tap off again, so it gets its own pass
+	tap = g_strdup_printf("%s/lintartarus-bench-tap-%d",
+		g_get_tmp_dir(),
+		getpid());
+	tap_init(tap);
+	unlink(tap);
+	g_free(tap);
+
+	printf("key events with the tap on:\n");
+	for (i = 0; i < G_N_ELEMENTS(_keymaps); i++) {
+		if (evs[i] == NULL || !_start(_keymaps[i])) {
+			continue;
+		}
+
+		printf(INDENT "%s:\n", _keymaps[i]);
+		_dispatch(evs[i], "input_read + tap:");
+		g_array_free(evs[i], TRUE);
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times keys.c against every combo in keymaps/: parsing them, and looking
+ * up key names. Each combo is also checked to make it through
+ * keys_dump() and back unchanged.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include "alloc.h"
+#include "keys.h"
+
+#define INDENT "    "
+
+/**
+ * Roughly how many times to run each thing being timed
+ */
+#define RUNS 1000000
+
+/**
+ * Every binding in every layout in the keymaps
+ */
+static GPtrArray* _load(const char *dir)
+{
+	guint i;
+	guint j;
+	GDir *d;
+	const char *name;
+	GPtrArray *combos = g_ptr_array_new_with_free_func(g_free);
+
+	d = g_dir_open(dir, 0, NULL);
+	if (d == NULL) {
+		g_error("failed to open %s", dir);
+	}
+
+	while ((name = g_dir_read_name(d))) {
+		char **groups;
+		char *path = g_strdup_printf("%s/%s", dir, name);
+		GKeyFile *kf = g_key_file_new();
+
+		if (!g_str_has_suffix(name, ".ini") ||
+			!g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, NULL)) {
+			g_key_file_free(kf);
+			g_free(path);
+			continue;
+		}
+
+		groups = g_key_file_get_groups(kf, NULL);
+		for (i = 0; groups[i] != NULL; i++) {
+			char **keys;
+
+			if (strchr(groups[i], ':') == NULL) {
+				continue;
+			}
+
+			keys = g_key_file_get_keys(kf, groups[i], NULL, NULL);
+			for (j = 0; keys[j] != NULL; j++) {
+				g_ptr_array_add(combos,
+					g_key_file_get_string(kf, groups[i], keys[j], NULL));
+			}
+
+			g_strfreev(keys);
+		}
+
+		g_strfreev(groups);
+		g_key_file_free(kf);
+		g_free(path);
+	}
+
+	g_dir_close(d);
+
+	return combos;
+}
+
+static gboolean _check(GPtrArray *combos)
+{
+	guint i;
+	guint failed = 0;
+	union combo_buf a;
+	union combo_buf b;
+
+	for (i = 0; i < combos->len; i++) {
+		char *dump;
+		const char *combo = g_ptr_array_index(combos, i);
+
+		if (!keys_parse(combo, &a)) {
+			printf(INDENT "FAIL: %s doesn't parse\n", combo);
+			failed++;
+			continue;
+		}
+
+		dump = keys_dump(&a.combo);
+		if (!keys_parse(dump, &b) ||
+			keys_combo_size(&a.combo) != keys_combo_size(&b.combo) ||
+			memcmp(&a.combo, &b.combo, keys_combo_size(&a.combo)) != 0) {
+			printf(INDENT "FAIL: %s came back as %s\n", combo, dump);
+			failed++;
+		}
+
+		g_free(dump);
+	}
+
+	printf(INDENT "%u combos, %u failed\n", combos->len, failed);
+
+	return failed == 0;
+}
+
+static void _parse(GPtrArray *combos)
+{
+	guint i;
+	guint j;
+	gsize allocs;
+	gint64 start;
+	gint64 elapsed;
+	union combo_buf buf;
+	guint runs = MAX(1, RUNS / MAX(1, combos->len));
+	guint n = runs * combos->len;
+
+	allocs = alloc_count();
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < runs; i++) {
+		for (j = 0; j < combos->len; j++) {
+			keys_parse(g_ptr_array_index(combos, j), &buf);
+		}
+	}
+
+	elapsed = g_get_monotonic_time() - start;
+	allocs = alloc_count() - allocs;
+
+	printf(INDENT "keys_parse: %u parses, %.1fns/parse, %.2f allocs/parse\n",
+		n,
+		elapsed * 1000.0 / MAX(1, n),
+		(gdouble)allocs / MAX(1, n));
+}
+
+static void _lookup(void)
+{
+	guint i;
+	guint j;
+	gsize allocs;
+	gint64 start;
+	gint64 elapsed;
+	guint misses = 0;
+	GArray *codes = keys_get_all_codes();
+	const char **names = g_new(const char*, codes->len);
+	guint runs = MAX(1, RUNS / codes->len);
+	guint n = runs * codes->len;
+
+	for (i = 0; i < codes->len; i++) {
+		names[i] = keys_val(g_array_index(codes, int, i));
+	}
+
+	allocs = alloc_count();
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < runs; i++) {
+		for (j = 0; j < codes->len; j++) {
+			misses += keys_code(names[j]) == 0;
+		}
+	}
+
+	elapsed = g_get_monotonic_time() - start;
+	allocs = alloc_count() - allocs;
+
+	printf(INDENT "keys_code: %u names, %.1fns/lookup, %.2f allocs/lookup, "
+		"%u misses\n",
+		codes->len,
+		elapsed * 1000.0 / n,
+		(gdouble)allocs / n,
+		misses);
+
+	g_free(names);
+	g_array_free(codes, TRUE);
+}
+
+int main(int argc, char **argv)
+{
+	gboolean ok;
+	GPtrArray *combos;
+	const char *dir = argc > 1 ? argv[1] : "keymaps";
+
+	combos = _load(dir);
+
+	printf("round trips (%s):\n", dir);
+	ok = _check(combos);
+
+	printf("\n");
+	printf("timings:\n");
+	_parse(combos);
+	_lookup();
+
+	g_ptr_array_free(combos, TRUE);
+
+	return ok ? 0 : 1;
+}
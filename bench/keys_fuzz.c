@@ -0,0 +1,98 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libFuzzer target for keys_parse(). Anything that parses has to be a
+ * well-formed combo, and has to come back the same through keys_dump().
+ *
+ * `make fuzz` builds it, along with a starting corpus of every combo in
+ * keymaps/.
+ */
+
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "keys.h"
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static void _quiet(
+	const gchar *domain G_GNUC_UNUSED,
+	GLogLevelFlags level G_GNUC_UNUSED,
+	const gchar *msg G_GNUC_UNUSED,
+	gpointer data G_GNUC_UNUSED)
+{
+}
+
+/**
+ * Walk the steps, making sure they add up to exactly len
+ */
+static gboolean _valid(const struct combo *combo)
+{
+	guint i;
+	guint at = 0;
+
+	for (i = 0; i < combo->steps; i++) {
+		if (at >= combo->len || combo->codes[at] <= 0) {
+			return FALSE;
+		}
+
+		at += 1 + combo->codes[at];
+	}
+
+	return at == combo->len &&
+		keys_combo_size(combo) <= sizeof(union combo_buf);
+}
+
+int LLVMFuzzerInitialize(
+	int *argc G_GNUC_UNUSED,
+	char ***argv G_GNUC_UNUSED)
+{
+	// Bad combos are expected, and complaining about each one is slow
+	g_log_set_handler(NULL, G_LOG_LEVEL_CRITICAL, _quiet, NULL);
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	char *dump;
+	union combo_buf a;
+	union combo_buf b;
+	char *keys = g_strndup((const char*)data, size);
+
+	if (keys_parse(keys, &a)) {
+		if (!_valid(&a.combo)) {
+			abort();
+		}
+
+		dump = keys_dump(&a.combo);
+		if (!keys_parse(dump, &b) ||
+			keys_combo_size(&a.combo) != keys_combo_size(&b.combo) ||
+			memcmp(&a.combo, &b.combo, keys_combo_size(&a.combo)) != 0) {
+			abort();
+		}
+
+		g_free(dump);
+	}
+
+	g_free(keys);
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "pcapng.h"
+
+#define BLOCK_SHB 0x0a0d0d0a
+#define BLOCK_IDB 0x00000001
+#define BLOCK_EPB 0x00000006
+
+#define BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+/**
+ * Link types of interest, and the size of the usbmon header each prefixes
+ * packets with
+ */
+#define LINKTYPE_USB_LINUX 189
+#define LINKTYPE_USB_LINUX_MMAPPED 220
+#define USBMON_HDR_LEN 48
+#define USBMON_MMAPPED_HDR_LEN 64
+
+/**
+ * Offsets into the usbmon header
+ */
+#define USBMON_TYPE 8
+#define USBMON_XFER_TYPE 9
+#define USBMON_EPNUM 10
+#define USBMON_FLAG_SETUP 14
+#define USBMON_SETUP 40
+
+#define USBMON_SUBMIT 'S'
+#define USBMON_XFER_CONTROL 2
+
+static guint32 _u32(const guint8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+static guint16 _u16(const guint8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void _ctrl_free(void *ctrl_)
+{
+	struct pcapng_ctrl *ctrl = ctrl_;
+	g_byte_array_free(ctrl->data, TRUE);
+	g_free(ctrl);
+}
+
+static void _packet(GPtrArray *ctrls, const guint8 *pkt, guint len, guint hdr)
+{
+	struct pcapng_ctrl *ctrl;
+
+	if (len < hdr) {
+		return;
+	}
+
+	if (pkt[USBMON_TYPE] != USBMON_SUBMIT ||
+		pkt[USBMON_XFER_TYPE] != USBMON_XFER_CONTROL ||
+		pkt[USBMON_EPNUM] != 0 ||
+		pkt[USBMON_FLAG_SETUP] != 0) {
+		return;
+	}
+
+	ctrl = g_malloc0(sizeof(*ctrl));
+	memcpy(ctrl->setup, pkt + USBMON_SETUP, sizeof(ctrl->setup));
+	ctrl->data = g_byte_array_new();
+	g_byte_array_append(ctrl->data, pkt + hdr, len - hdr);
+	g_ptr_array_add(ctrls, ctrl);
+}
+
+GPtrArray* pcapng_read_ctrl_out(const char *path, GError **error)
+{
+	gsize len;
+	gsize off;
+	guint8 *buf;
+	GPtrArray *ctrls;
+	GArray *hdrs = g_array_new(FALSE, TRUE, sizeof(guint));
+
+	if (!g_file_get_contents(path, (char**)&buf, &len, error)) {
+		g_array_free(hdrs, TRUE);
+		return NULL;
+	}
+
+	ctrls = g_ptr_array_new_with_free_func(_ctrl_free);
+
+	for (off = 0; off + 12 <= len; ) {
+		guint hdr;
+		guint32 type = _u32(buf + off);
+		guint32 blen = _u32(buf + off + 4);
+
+		if (blen < 12 || off + blen > len) {
+			g_critical("%s: truncated block at offset %" G_GSIZE_FORMAT,
+				path,
+				off);
+			break;
+		}
+
+		switch (type) {
+			case BLOCK_SHB:
+				if (_u32(buf + off + 8) != BYTE_ORDER_MAGIC) {
+					g_critical("%s: only little-endian captures are supported",
+						path);
+					goto out;
+				}
+
+				g_array_set_size(hdrs, 0);
+				break;
+
+			case BLOCK_IDB:
+				switch (_u16(buf + off + 8)) {
+					case LINKTYPE_USB_LINUX:
+						hdr = USBMON_HDR_LEN;
+						break;
+
+					case LINKTYPE_USB_LINUX_MMAPPED:
+						hdr = USBMON_MMAPPED_HDR_LEN;
+						break;
+
+					default:
+						hdr = 0;
+						break;
+				}
+
+				g_array_append_val(hdrs, hdr);
+				break;
+
+			case BLOCK_EPB: {
+				guint32 iface = _u32(buf + off + 8);
+				guint32 caplen = _u32(buf + off + 20);
+
+				if (iface >= hdrs->len || 28 + caplen > blen) {
+					break;
+				}
+
+				hdr = g_array_index(hdrs, guint, iface);
+				if (hdr != 0) {
+					_packet(ctrls, buf + off + 28, caplen, hdr);
+				}
+
+				break;
+			}
+		}
+
+		off += blen;
+	}
+
+out:
+	g_free(buf);
+	g_array_free(hdrs, TRUE);
+
+	return ctrls;
+}
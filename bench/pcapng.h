@@ -0,0 +1,42 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+
+/**
+ * A control OUT transfer pulled out of a capture
+ */
+struct pcapng_ctrl {
+	/**
+	 * Setup packet, as it went over the wire
+	 */
+	guint8 setup[8];
+
+	/**
+	 * Data stage
+	 */
+	GByteArray *data;
+};
+
+/**
+ * Read all control OUT submissions from a usbmon pcapng capture (as written
+ * by wireshark on Linux). Returns an array of struct pcapng_ctrl, or NULL
+ * if the capture couldn't be read.
+ */
+GPtrArray* pcapng_read_ctrl_out(const char *path, GError **error);
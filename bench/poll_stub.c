@@ -0,0 +1,205 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stands in for poll.c: benchmarks drive callbacks by hand instead of
+ * sitting in epoll_wait().
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include "poll_stub.h"
+
+struct _reg {
+	int fd;
+	poll_cb cb;
+	void *data;
+};
+
+struct poll_timer {
+	poll_timer_cb cb;
+	void *data;
+	gint64 due;
+	gboolean armed;
+};
+
+static GArray *_regs;
+static GPtrArray *_timers;
+static gint64 (*_clock)(void) = g_get_monotonic_time;
+
+static struct _reg* _find(int fd)
+{
+	guint i;
+
+	for (i = 0; _regs != NULL && i < _regs->len; i++) {
+		struct _reg *r = &g_array_index(_regs, struct _reg, i);
+		if (r->fd == fd) {
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+void poll_init(void)
+{
+	_regs = g_array_new(FALSE, FALSE, sizeof(struct _reg));
+	_timers = g_ptr_array_new_with_free_func(g_free);
+}
+
+void poll_mod(
+	int fd,
+	const char *name G_GNUC_UNUSED,
+	poll_cb cb,
+	void *data,
+	enum poll_prio prio G_GNUC_UNUSED,
+	gboolean read G_GNUC_UNUSED,
+	gboolean write G_GNUC_UNUSED)
+{
+	struct _reg reg = {
+		.fd = fd,
+		.cb = cb,
+		.data = data,
+	};
+	struct _reg *r = _find(fd);
+
+	if (r != NULL) {
+		r->cb = cb;
+		r->data = data;
+	} else {
+		g_array_append_val(_regs, reg);
+	}
+}
+
+void poll_rm(int fd)
+{
+	guint i;
+
+	for (i = 0; i < _regs->len; i++) {
+		if (g_array_index(_regs, struct _reg, i).fd == fd) {
+			g_array_remove_index(_regs, i);
+			return;
+		}
+	}
+}
+
+const struct poll_stats* poll_get_stats(int fd G_GNUC_UNUSED)
+{
+	// Handlers aren't timed here
+	return NULL;
+}
+
+void poll_set_stall_budget(guint ms G_GNUC_UNUSED)
+{
+}
+
+void poll_run(void)
+{
+	g_error("poll_run() isn't available in benchmarks");
+}
+
+guint poll_stub_count(void)
+{
+	return _regs->len;
+}
+
+int poll_stub_fd(guint i)
+{
+	return g_array_index(_regs, struct _reg, i).fd;
+}
+
+void poll_stub_fire(int fd)
+{
+	struct _reg *r = _find(fd);
+
+	if (r != NULL) {
+		r->cb(fd, r->data);
+	}
+}
+
+struct poll_timer* poll_timer_new(poll_timer_cb cb, void *data)
+{
+	struct poll_timer *t = g_malloc0(sizeof(*t));
+
+	t->cb = cb;
+	t->data = data;
+	g_ptr_array_add(_timers, t);
+
+	return t;
+}
+
+void poll_timer_free(struct poll_timer *t)
+{
+	g_ptr_array_remove_fast(_timers, t);
+}
+
+void poll_timer_arm(struct poll_timer *t, guint ms)
+{
+	t->due = _clock() + (gint64)ms * 1000;
+	t->armed = TRUE;
+}
+
+void poll_timer_cancel(struct poll_timer *t)
+{
+	t->armed = FALSE;
+}
+
+void poll_timers_run(void)
+{
+	gint64 due;
+	struct poll_timer *t;
+
+	while ((t = poll_stub_next_timer(&due)) != NULL && due <= _clock()) {
+		poll_stub_fire_timer(t);
+	}
+}
+
+void poll_set_clock(gint64 (*now)(void))
+{
+	_clock = now;
+}
+
+gint64 poll_now(void)
+{
+	return _clock();
+}
+
+struct poll_timer* poll_stub_next_timer(gint64 *due)
+{
+	guint i;
+	struct poll_timer *next = NULL;
+
+	for (i = 0; i < _timers->len; i++) {
+		struct poll_timer *t = g_ptr_array_index(_timers, i);
+		if (t->armed && (next == NULL || t->due < next->due)) {
+			next = t;
+		}
+	}
+
+	if (next != NULL) {
+		*due = next->due;
+	}
+
+	return next;
+}
+
+void poll_stub_fire_timer(struct poll_timer *t)
+{
+	t->armed = FALSE;
+	t->cb(t->data);
+}
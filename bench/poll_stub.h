@@ -0,0 +1,46 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+#include "poll.h"
+
+/**
+ * Number of fds registered through poll_mod()
+ */
+guint poll_stub_count(void);
+
+/**
+ * Get the i'th registered fd
+ */
+int poll_stub_fd(guint i);
+
+/**
+ * Run the callback registered for an fd, as if it were ready
+ */
+void poll_stub_fire(int fd);
+
+/**
+ * Find the armed timer that fires first, and when
+ */
+struct poll_timer* poll_stub_next_timer(gint64 *due);
+
+/**
+ * Fire a timer, as if it expired
+ */
+void poll_stub_fire_timer(struct poll_timer *t);
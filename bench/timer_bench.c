@@ -0,0 +1,195 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs poll.c's timer wheel on a simulated clock: arming, cancelling and
+ * firing thousands of timers at once, checking that each one fires on time
+ * and exactly once.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "alloc.h"
+#include "callbacks.h"
+#include "poll.h"
+
+#define INDENT "    "
+
+/**
+ * Longest delay to arm with, in ms
+ */
+#define MAX_DELAY (10 * 60 * 1000)
+
+/**
+ * Most the clock moves forward between runs, in us: however long the loop
+ * happens to sleep
+ */
+#define MAX_STEP 20000
+
+struct _timer {
+	struct poll_timer *t;
+
+	/**
+	 * When the timer should fire, in us
+	 */
+	gint64 due;
+
+	guint fired;
+};
+
+static gint64 _clock;
+
+/**
+ * How late timers fired, in us
+ */
+static gint64 _late;
+static gint64 _late_max;
+
+static guint _early;
+static guint _fired;
+
+void cbs_poll_tick(void)
+{
+}
+
+static gint64 _now(void)
+{
+	return _clock;
+}
+
+static void _fire(void *data)
+{
+	struct _timer *t = data;
+	gint64 late = _clock - t->due;
+
+	if (late < 0) {
+		_early++;
+	}
+
+	_late += late;
+	_late_max = MAX(_late_max, late);
+	_fired++;
+	t->fired++;
+}
+
+static gdouble _ns(gint64 elapsed, guint n)
+{
+	return elapsed * 1000.0 / MAX(1, n);
+}
+
+static gboolean _bench(guint n)
+{
+	guint i;
+	gsize allocs;
+	gint64 start;
+	gint64 arm;
+	gint64 cancel;
+	gint64 run;
+	guint runs = 0;
+	guint cancelled = 0;
+	guint wrong = 0;
+	GRand *r = g_rand_new_with_seed(n);
+	struct _timer *ts = g_new0(struct _timer, n);
+
+	_clock = g_rand_int_range(r, 0, G_MAXINT32);
+	_late = 0;
+	_late_max = 0;
+	_early = 0;
+	_fired = 0;
+
+	for (i = 0; i < n; i++) {
+		ts[i].t = poll_timer_new(_fire, ts + i);
+	}
+
+	allocs = alloc_count();
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < n; i++) {
+		guint ms = g_rand_int_range(r, 0, MAX_DELAY);
+
+		ts[i].due = _clock + (gint64)ms * 1000;
+		poll_timer_arm(ts[i].t, ms);
+	}
+
+	arm = g_get_monotonic_time() - start;
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < n; i += 2) {
+		poll_timer_cancel(ts[i].t);
+		cancelled++;
+	}
+
+	cancel = g_get_monotonic_time() - start;
+	start = g_get_monotonic_time();
+
+	while (_fired < n - cancelled && runs < MAX_DELAY) {
+		_clock += g_rand_int_range(r, 1, MAX_STEP);
+		poll_timers_run();
+		runs++;
+	}
+
+	run = g_get_monotonic_time() - start;
+	allocs = alloc_count() - allocs;
+
+	for (i = 0; i < n; i++) {
+		wrong += ts[i].fired != (i % 2 == 0 ? 0u : 1u);
+		poll_timer_free(ts[i].t);
+	}
+
+	printf(INDENT "%6u timers: arm %6.1fns, cancel %5.1fns, "
+		"run %7.1fns/run over %u runs, %.2f allocs/timer\n",
+		n,
+		_ns(arm, n),
+		_ns(cancel, cancelled),
+		_ns(run, runs),
+		runs,
+		(gdouble)allocs / n);
+	printf(INDENT "%6s late by %.2fms on average, %.2fms at most; "
+		"%u early, %u wrong\n",
+		"",
+		_late / 1000.0 / MAX(1, _fired),
+		_late_max / 1000.0,
+		_early,
+		wrong);
+
+	g_free(ts);
+	g_rand_free(r);
+
+	return _early == 0 && wrong == 0 && _late_max <= MAX_STEP + 1000;
+}
+
+int main(int argc, char **argv)
+{
+	guint i;
+	gboolean ok = TRUE;
+	const guint counts[] = { 10, 1000, 10000, 100000 };
+	guint max = argc > 1 ? strtoul(argv[1], NULL, 10) : G_MAXUINT;
+
+	poll_init();
+	poll_set_clock(_now);
+
+	printf("timers (up to %ums out, clock steps up to %ums):\n",
+		MAX_DELAY,
+		MAX_STEP / 1000);
+	for (i = 0; i < G_N_ELEMENTS(counts) && counts[i] <= max; i++) {
+		ok &= _bench(counts[i]);
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stands in for the output keyboard: keys go nowhere, they're just counted.
+ */
+
+#include <glib.h>
+#include "uinput_stub.h"
+
+static guint _sent;
+
+void uinput_init(void)
+{
+}
+
+void uinput_send(int code G_GNUC_UNUSED, int value G_GNUC_UNUSED)
+{
+	_sent++;
+}
+
+guint uinput_stub_sent(void)
+{
+	return _sent;
+}
@@ -0,0 +1,338 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs usb.c against a simulated device. First, every capture in wireshark/
+ * is checked byte-for-byte against what usb.c sends for the same state. Then
+ * a few state change patterns are timed to see how much USB traffic each
+ * generates and how long the device takes to catch up.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "const.h"
+#include "effects.h"
+#include "pcapng.h"
+#include "poll_stub.h"
+#include "state.h"
+#include "usb.h"
+#include "usb_sim.h"
+
+#define INDENT "    "
+
+/**
+ * Give up on a run that doesn't settle after this many events
+ */
+#define MAX_EVENTS 1000000
+
+#define LAYOUTS 8
+#define BACKLIGHTS (backlight_pulse + 1)
+
+struct _capture {
+	const char *name;
+	guint layout;
+	enum usb_backlight backlight;
+};
+
+/**
+ * What state each capture ends in. The windows util's 8th layout is our
+ * "no layout", and all backlight changes were captured on the 3rd layout.
+ */
+static const struct _capture _captures[] = {
+	{ "k1", 1, backlight_low },
+	{ "k2", 2, backlight_low },
+	{ "k3", 3, backlight_low },
+	{ "k4", 4, backlight_low },
+	{ "k5", 5, backlight_low },
+	{ "k6", 6, backlight_low },
+	{ "k7", 7, backlight_low },
+	{ "k8", 0, backlight_low },
+	{ "bright_to_pulsate", 3, backlight_pulse },
+	{ "dim_to_off", 3, backlight_off },
+	{ "high_to_normal", 3, backlight_med },
+	{ "high_to_off", 3, backlight_off },
+	{ "normal_to_dim", 3, backlight_low },
+	{ "off_to_high", 3, backlight_high },
+	{ "off_to_pulsate", 3, backlight_pulse },
+	{ "pulsate_to_high", 3, backlight_high },
+	{ "pulsate_to_off", 3, backlight_off },
+};
+
+/**
+ * What the device shows for each state, once usb.c is done with it
+ */
+static struct sim_image _golden[LAYOUTS][BACKLIGHTS];
+
+static const struct sim_opts _instant;
+
+static void _set(guint layout, enum usb_backlight backlight)
+{
+	cfg.usb.backlight = backlight;
+	state_set_prog(0, getpid());
+	state_set_layout(layout);
+	state_has_changed();
+
+	// Same as callbacks.c
+	effects_on_state_changed();
+	usb_on_state_changed();
+}
+
+/**
+ * Run the next thing that happens, as long as it happens by `until`
+ */
+static gboolean _step(gint64 until)
+{
+	gint64 due;
+	struct poll_timer *t;
+	gint64 next = sim_next_completion();
+
+	if (next != -1 && next <= until) {
+		sim_advance(next);
+		poll_stub_fire(sim_fd());
+		return TRUE;
+	}
+
+	t = poll_stub_next_timer(&due);
+	if (t != NULL && due <= until) {
+		sim_advance(due);
+		poll_stub_fire_timer(t);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void _run_until(gint64 t)
+{
+	guint i;
+
+	for (i = 0; i < MAX_EVENTS && _step(t); i++);
+	sim_advance(t);
+}
+
+static gboolean _settle(void)
+{
+	guint i;
+
+	for (i = 0; i < MAX_EVENTS; i++) {
+		if (!_step(G_MAXINT64)) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void _build_golden(void)
+{
+	guint layout;
+	guint backlight;
+
+	for (layout = 0; layout < LAYOUTS; layout++) {
+		for (backlight = 0; backlight < BACKLIGHTS; backlight++) {
+			sim_reset(&_instant);
+			_set(layout, backlight);
+			_settle();
+			_golden[layout][backlight] = *sim_get_image();
+		}
+	}
+}
+
+static gboolean _check_capture(const char *dir, const struct _capture *c)
+{
+	guint i;
+	guint j;
+	GError *error = NULL;
+	gboolean ok = TRUE;
+	const struct sim_image *img = &_golden[c->layout][c->backlight];
+	char *path = g_strdup_printf("%s/%s.pcapng", dir, c->name);
+	GPtrArray *ctrls = pcapng_read_ctrl_out(path, &error);
+
+	if (ctrls == NULL) {
+		printf(INDENT "%-20s FAIL: %s\n", c->name, error->message);
+		g_clear_error(&error);
+		g_free(path);
+		return FALSE;
+	}
+
+	for (i = 0; i < ctrls->len; i++) {
+		struct pcapng_ctrl *ctrl = g_ptr_array_index(ctrls, i);
+		int slot = sim_cmd_slot(ctrl->data->data, ctrl->data->len);
+
+		if (slot == -1) {
+			printf(INDENT "%-20s FAIL: transfer %u isn't a known command\n",
+				c->name,
+				i);
+			ok = FALSE;
+			continue;
+		}
+
+		if (memcmp(ctrl->setup, img->setup[slot], sizeof(ctrl->setup)) != 0) {
+			printf(INDENT "%-20s FAIL: transfer %u: setup packet differs\n",
+				c->name,
+				i);
+			ok = FALSE;
+		}
+
+		for (j = 0; j < CMD_LEN; j++) {
+			if (ctrl->data->data[j] != img->cmdv[slot][j]) {
+				printf(INDENT "%-20s FAIL: transfer %u: byte %u: "
+					"captured 0x%02x, sent 0x%02x\n",
+					c->name,
+					i,
+					j,
+					ctrl->data->data[j],
+					img->cmdv[slot][j]);
+				ok = FALSE;
+				break;
+			}
+		}
+	}
+
+	if (ok) {
+		printf(INDENT "%-20s ok (%u commands)\n", c->name, ctrls->len);
+	}
+
+	g_ptr_array_free(ctrls, TRUE);
+	g_free(path);
+
+	return ok;
+}
+
+static void _burst(
+	const char *name,
+	const struct sim_opts *opts,
+	guint changes,
+	gint64 interval)
+{
+	guint i;
+	gint64 last;
+	gint64 settle;
+	gboolean ok;
+	struct sim_stats base;
+	const struct sim_stats *stats;
+	guint layout = 1;
+	enum usb_backlight backlight = backlight_low;
+
+	sim_reset(opts);
+	_set(layout, backlight);
+	_settle();
+	base = *sim_get_stats();
+
+	last = sim_now();
+	for (i = 0; i < changes; i++) {
+		_run_until(last + (i == 0 ? 0 : interval));
+		layout = layout % (LAYOUTS - 1) + 1;
+		_set(layout, backlight);
+		last = sim_now();
+	}
+
+	ok = _settle();
+	ok = ok && memcmp(sim_get_image(),
+		&_golden[layout][backlight],
+		sizeof(struct sim_image)) == 0;
+	settle = MAX(0, sim_image_changed_at() - last);
+
+	stats = sim_get_stats();
+	printf(INDENT "%-8s %5u changes every %6.2fms: "
+		"%6.2f transfers/change, %4u failed, %3u reopens, "
+		"settled in %7.2fms%s\n",
+		name,
+		changes,
+		interval / 1000.0,
+		(gdouble)(stats->transfers - base.transfers) / changes,
+		stats->failed - base.failed,
+		stats->opens - base.opens,
+		settle / 1000.0,
+		ok ? "" : " (WRONG FINAL STATE)");
+}
+
+static void _cpu(guint syncs)
+{
+	guint i;
+	gint64 start;
+	gint64 elapsed;
+
+	sim_reset(&_instant);
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < syncs; i++) {
+		_set(i % (LAYOUTS - 1) + 1, backlight_low);
+		_settle();
+	}
+	elapsed = g_get_monotonic_time() - start;
+
+	printf(INDENT "%u syncs: %.0fns/sync, %.0fns/transfer\n",
+		syncs,
+		elapsed * 1000.0 / syncs,
+		elapsed * 1000.0 / sim_get_stats()->transfers);
+}
+
+int main(int argc, char **argv)
+{
+	guint i;
+	gboolean ok = TRUE;
+	const char *dir = argc > 1 ? argv[1] : "wireshark";
+	const struct sim_opts usb1 = {
+		.latency = 1000,
+	};
+	const struct sim_opts jittery = {
+		.latency = 1000,
+		.jitter = 3000,
+	};
+	const struct sim_opts flaky = {
+		.latency = 1000,
+		.fail_rate = 0.02,
+	};
+
+	memset(&cfg, 0, sizeof(cfg));
+	state_init();
+	poll_init();
+	poll_set_clock(sim_now);
+	effects_init();
+
+	sim_reset(&_instant);
+	usb_init();
+	_settle();
+
+	_build_golden();
+
+	printf("captures (%s):\n", dir);
+	for (i = 0; i < G_N_ELEMENTS(_captures); i++) {
+		ok &= _check_capture(dir, _captures + i);
+	}
+
+	printf("\n");
+	printf("lighting syncs (1ms/transfer unless noted):\n");
+	_burst("single", &usb1, 1, 0);
+	_burst("hold", &usb1, 200, 33000);
+	_burst("spam", &usb1, 200, 2000);
+	_burst("burst", &usb1, 200, 0);
+	_burst("jitter", &jittery, 200, 2000);
+	_burst("flaky", &flaky, 200, 33000);
+
+	printf("\n");
+	printf("cpu (instant device):\n");
+	_cpu(100000);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,386 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A fake libusb, linked in place of the real one, that models a Tartarus on
+ * the other end of usb.c. Transfers complete against a simulated clock, so
+ * nothing here ever sleeps.
+ */
+
+#include <glib.h>
+#include <libusb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "const.h"
+#include "usb_sim.h"
+
+struct libusb_device {
+	int unused;
+};
+
+struct libusb_device_handle {
+	libusb_device *dev;
+};
+
+struct _pending {
+	struct libusb_transfer *xfer;
+	gint64 due;
+	gboolean fail;
+	gboolean cancelled;
+};
+
+static libusb_device _dev;
+static libusb_device_handle *_open;
+static int _efd = -1;
+static GRand *_rand;
+static struct sim_opts _opts;
+static struct sim_stats _stats;
+static struct sim_image _image;
+static gint64 _now;
+static gint64 _changed_at;
+static GQueue _pending = G_QUEUE_INIT;
+
+void sim_reset(const struct sim_opts *opts)
+{
+	_opts = *opts;
+	memset(&_stats, 0, sizeof(_stats));
+	memset(&_image, 0, sizeof(_image));
+	_now = 0;
+	_changed_at = 0;
+
+	if (_rand != NULL) {
+		g_rand_free(_rand);
+	}
+
+	// Fixed seed: runs need to be comparable
+	_rand = g_rand_new_with_seed(0x7a27a2);
+}
+
+gint64 sim_now(void)
+{
+	return _now;
+}
+
+void sim_advance(gint64 t)
+{
+	_now = MAX(_now, t);
+}
+
+gint64 sim_next_completion(void)
+{
+	struct _pending *p = g_queue_peek_head(&_pending);
+	return p == NULL ? -1 : p->due;
+}
+
+gboolean sim_is_open(void)
+{
+	return _open != NULL;
+}
+
+int sim_fd(void)
+{
+	return _efd;
+}
+
+const struct sim_stats* sim_get_stats(void)
+{
+	return &_stats;
+}
+
+const struct sim_image* sim_get_image(void)
+{
+	return &_image;
+}
+
+gint64 sim_image_changed_at(void)
+{
+	return _changed_at;
+}
+
+int sim_cmd_slot(const guint8 *cmd, guint len)
+{
+	int i;
+
+	if (len != CMD_LEN) {
+		return -1;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (memcmp(cmd, layout_cmds[i], ARG1I) == 0) {
+			return i;
+		}
+	}
+
+	if (memcmp(cmd, light_level_cmd, ARG1I) == 0) {
+		return 3;
+	}
+
+	if (memcmp(cmd, pulsate_cmd, ARG1I) == 0) {
+		return 4;
+	}
+
+	return -1;
+}
+
+static void _accept(struct libusb_transfer *xfer)
+{
+	int slot;
+	guint8 *data = xfer->buffer + LIBUSB_CONTROL_SETUP_SIZE;
+	int len = xfer->length - LIBUSB_CONTROL_SETUP_SIZE;
+
+	// Only OUT transfers change anything on the device
+	if (xfer->buffer[0] & LIBUSB_ENDPOINT_IN) {
+		return;
+	}
+
+	slot = sim_cmd_slot(data, len);
+	if (slot == -1) {
+		g_critical("sim: device got unknown command");
+		return;
+	}
+
+	if (memcmp(_image.setup[slot], xfer->buffer, 8) != 0 ||
+		memcmp(_image.cmdv[slot], data, CMD_LEN) != 0) {
+		memcpy(_image.setup[slot], xfer->buffer, 8);
+		memcpy(_image.cmdv[slot], data, CMD_LEN);
+		_changed_at = _now;
+	}
+}
+
+/*
+ * libusb, as far as usb.c is concerned
+ */
+
+int libusb_init(libusb_context **ctx)
+{
+	if (ctx != NULL) {
+		*ctx = NULL;
+	}
+
+	_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_efd == -1) {
+		return LIBUSB_ERROR_OTHER;
+	}
+
+	return LIBUSB_SUCCESS;
+}
+
+const char* libusb_strerror(int err)
+{
+	return err == LIBUSB_SUCCESS ? "success" : "simulated error";
+}
+
+const struct libusb_pollfd** libusb_get_pollfds(
+	libusb_context *ctx G_GNUC_UNUSED)
+{
+	static struct libusb_pollfd pfd;
+	const struct libusb_pollfd **fds = calloc(2, sizeof(*fds));
+
+	pfd.fd = _efd;
+	pfd.events = POLLIN;
+	fds[0] = &pfd;
+
+	return fds;
+}
+
+void libusb_set_pollfd_notifiers(
+	libusb_context *ctx G_GNUC_UNUSED,
+	libusb_pollfd_added_cb added G_GNUC_UNUSED,
+	libusb_pollfd_removed_cb removed G_GNUC_UNUSED,
+	void *user_data G_GNUC_UNUSED)
+{
+}
+
+int libusb_hotplug_register_callback(
+	libusb_context *ctx,
+	int events,
+	int flags,
+	int vendor_id G_GNUC_UNUSED,
+	int product_id G_GNUC_UNUSED,
+	int dev_class G_GNUC_UNUSED,
+	libusb_hotplug_callback_fn cb,
+	void *user_data,
+	libusb_hotplug_callback_handle *handle G_GNUC_UNUSED)
+{
+	// The device is always plugged in
+	if ((flags & LIBUSB_HOTPLUG_ENUMERATE) &&
+		(events & LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)) {
+		cb(ctx, &_dev, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, user_data);
+	}
+
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_open(libusb_device *dev, libusb_device_handle **devh)
+{
+	if (_open != NULL) {
+		return LIBUSB_ERROR_BUSY;
+	}
+
+	_stats.opens++;
+	_open = g_malloc0(sizeof(*_open));
+	_open->dev = dev;
+	*devh = _open;
+
+	return LIBUSB_SUCCESS;
+}
+
+libusb_device_handle* libusb_open_device_with_vid_pid(
+	libusb_context *ctx G_GNUC_UNUSED,
+	uint16_t vendor_id,
+	uint16_t product_id)
+{
+	libusb_device_handle *devh = NULL;
+
+	if (vendor_id == VENDOR && product_id == PRODUCT) {
+		libusb_open(&_dev, &devh);
+	}
+
+	return devh;
+}
+
+void libusb_close(libusb_device_handle *devh)
+{
+	if (devh == NULL) {
+		return;
+	}
+
+	if (devh == _open) {
+		_open = NULL;
+	}
+
+	g_free(devh);
+}
+
+int libusb_set_auto_detach_kernel_driver(
+	libusb_device_handle *devh G_GNUC_UNUSED,
+	int enable G_GNUC_UNUSED)
+{
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_claim_interface(libusb_device_handle *devh G_GNUC_UNUSED, int iface)
+{
+	return iface == wINDEX ? LIBUSB_SUCCESS : LIBUSB_ERROR_NOT_FOUND;
+}
+
+int libusb_release_interface(
+	libusb_device_handle *devh G_GNUC_UNUSED,
+	int iface G_GNUC_UNUSED)
+{
+	return LIBUSB_SUCCESS;
+}
+
+struct libusb_transfer* libusb_alloc_transfer(int iso_packets G_GNUC_UNUSED)
+{
+	return g_malloc0(sizeof(struct libusb_transfer));
+}
+
+void libusb_free_transfer(struct libusb_transfer *xfer)
+{
+	g_free(xfer);
+}
+
+int libusb_submit_transfer(struct libusb_transfer *xfer)
+{
+	guint64 one = 1;
+	struct _pending *p;
+
+	if (xfer->dev_handle == NULL || xfer->dev_handle != _open) {
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+
+	_stats.transfers++;
+
+	p = g_malloc0(sizeof(*p));
+	p->xfer = xfer;
+	p->due = _now + _opts.latency;
+	if (_opts.jitter > 0) {
+		p->due += g_rand_int_range(_rand, 0, _opts.jitter + 1);
+	}
+
+	p->fail = g_rand_double(_rand) < _opts.fail_rate;
+
+	// Transfers on the control endpoint go one at a time
+	if (!g_queue_is_empty(&_pending)) {
+		struct _pending *last = _pending.tail->data;
+		p->due = MAX(p->due, last->due + _opts.latency);
+	}
+
+	g_queue_push_tail(&_pending, p);
+
+	if (write(_efd, &one, sizeof(one)) != sizeof(one)) {
+		g_critical("sim: failed to signal eventfd");
+	}
+
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *xfer)
+{
+	GList *l;
+
+	for (l = _pending.head; l != NULL; l = l->next) {
+		struct _pending *p = l->data;
+		if (p->xfer == xfer) {
+			p->cancelled = TRUE;
+			p->due = _now;
+			return LIBUSB_SUCCESS;
+		}
+	}
+
+	return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int libusb_handle_events_completed(
+	libusb_context *ctx G_GNUC_UNUSED,
+	int *completed G_GNUC_UNUSED)
+{
+	guint64 val;
+	struct _pending *p;
+
+	while (read(_efd, &val, sizeof(val)) > 0);
+
+	while ((p = g_queue_peek_head(&_pending)) != NULL && p->due <= _now) {
+		struct libusb_transfer *xfer = p->xfer;
+
+		g_queue_pop_head(&_pending);
+
+		if (p->cancelled) {
+			_stats.cancelled++;
+			xfer->status = LIBUSB_TRANSFER_CANCELLED;
+			xfer->actual_length = 0;
+		} else if (p->fail) {
+			_stats.failed++;
+			xfer->status = LIBUSB_TRANSFER_ERROR;
+			xfer->actual_length = 0;
+		} else {
+			_accept(xfer);
+			xfer->status = LIBUSB_TRANSFER_COMPLETED;
+			xfer->actual_length = xfer->length - LIBUSB_CONTROL_SETUP_SIZE;
+		}
+
+		g_free(p);
+		xfer->callback(xfer);
+	}
+
+	return LIBUSB_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+#include "const.h"
+
+/**
+ * How the simulated device behaves
+ */
+struct sim_opts {
+	/**
+	 * How long each control transfer takes, in us of simulated time
+	 */
+	guint latency;
+
+	/**
+	 * Random extra time added to each transfer, in us
+	 */
+	guint jitter;
+
+	/**
+	 * Chance, from 0 to 1, that any given transfer fails
+	 */
+	gdouble fail_rate;
+};
+
+/**
+ * Counters kept by the simulator
+ */
+struct sim_stats {
+	guint transfers;
+	guint failed;
+	guint cancelled;
+	guint opens;
+};
+
+/**
+ * What the device currently shows: the last accepted command for each slot
+ * (layout lights a/b/c, light level, pulsate), along with the setup packet
+ * it was sent with
+ */
+struct sim_image {
+	guint8 setup[CMDS_MAX][8];
+	guint8 cmdv[CMDS_MAX][CMD_LEN];
+};
+
+/**
+ * Change device behavior and clear all counters, the device image, and the
+ * simulated clock
+ */
+void sim_reset(const struct sim_opts *opts);
+
+/**
+ * Current simulated time, in us
+ */
+gint64 sim_now(void);
+
+/**
+ * Move the simulated clock forward
+ */
+void sim_advance(gint64 t);
+
+/**
+ * When the next in-flight transfer completes, or -1 if there isn't one
+ */
+gint64 sim_next_completion(void);
+
+/**
+ * If usb.c currently has the device open
+ */
+gboolean sim_is_open(void);
+
+/**
+ * The fd usb.c polls for libusb events
+ */
+int sim_fd(void);
+
+/**
+ * Counters since the last reset
+ */
+const struct sim_stats* sim_get_stats(void);
+
+/**
+ * What the device is displaying
+ */
+const struct sim_image* sim_get_image(void);
+
+/**
+ * When the device image last changed, in simulated us
+ */
+gint64 sim_image_changed_at(void);
+
+/**
+ * Find which command slot a command belongs to, or -1 if it's not a lighting
+ * command
+ */
+int sim_cmd_slot(const guint8 *cmd, guint len);
@@ -0,0 +1,136 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "arena.h"
+
+/**
+ * Size of each block taken from the heap
+ */
+#define BLOCK 16384
+
+/**
+ * Anything bigger than this gets a block of its own, so that it doesn't
+ * waste the rest of the current one
+ */
+#define BIG (BLOCK / 4)
+
+#define ALIGN 8
+
+struct block {
+	struct block *next;
+	gsize size;
+	gsize used;
+	guint8 data[] __attribute__((aligned(ALIGN)));
+};
+
+struct arena {
+	/**
+	 * The block currently being allocated from, followed by all full ones
+	 */
+	struct block *head;
+
+	gsize size;
+};
+
+static struct block* _block_new(struct arena *a, gsize size)
+{
+	struct block *b = g_malloc(sizeof(*b) + size);
+
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	a->size += sizeof(*b) + size;
+
+	return b;
+}
+
+struct arena* arena_new(void)
+{
+	return g_malloc0(sizeof(struct arena));
+}
+
+void arena_free(struct arena *a)
+{
+	struct block *b;
+
+	if (a == NULL) {
+		return;
+	}
+
+	while (a->head != NULL) {
+		b = a->head;
+		a->head = b->next;
+		g_free(b);
+	}
+
+	g_free(a);
+}
+
+void* arena_alloc(struct arena *a, gsize size)
+{
+	void *p;
+	struct block *b;
+
+	size = (size + (ALIGN - 1)) & ~(gsize)(ALIGN - 1);
+
+	if (size > BIG) {
+		b = _block_new(a, size);
+		b->used = size;
+
+		// Tucked behind the head so the head keeps its free space
+		if (a->head == NULL) {
+			a->head = b;
+		} else {
+			b->next = a->head->next;
+			a->head->next = b;
+		}
+	} else {
+		b = a->head;
+		if (b == NULL || b->size - b->used < size) {
+			b = _block_new(a, BLOCK);
+			b->next = a->head;
+			a->head = b;
+		}
+
+		b->used += size;
+	}
+
+	p = b->data + b->used - size;
+	memset(p, 0, size);
+
+	return p;
+}
+
+void* arena_dup(struct arena *a, const void *data, gsize size)
+{
+	void *p = arena_alloc(a, size);
+	memcpy(p, data, size);
+	return p;
+}
+
+char* arena_strdup(struct arena *a, const char *s)
+{
+	return arena_dup(a, s, strlen(s) + 1);
+}
+
+gsize arena_size(const struct arena *a)
+{
+	return a->size;
+}
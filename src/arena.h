@@ -0,0 +1,56 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+
+/**
+ * A bump allocator: everything allocated from an arena is freed at once, with
+ * the arena
+ */
+struct arena;
+
+/**
+ * Create an empty arena
+ */
+struct arena* arena_new(void);
+
+/**
+ * Free an arena and everything allocated from it
+ */
+void arena_free(struct arena *a);
+
+/**
+ * Get `size` zeroed bytes, aligned for anything
+ */
+void* arena_alloc(struct arena *a, gsize size);
+
+/**
+ * Copy `size` bytes into the arena
+ */
+void* arena_dup(struct arena *a, const void *data, gsize size);
+
+/**
+ * Copy a string into the arena
+ */
+char* arena_strdup(struct arena *a, const char *s);
+
+/**
+ * Total bytes the arena has taken from the heap
+ */
+gsize arena_size(const struct arena *a);
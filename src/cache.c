@@ -0,0 +1,210 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "keys.h"
+#include "log.h"
+
+#define MAGIC "LTARCFG"
+#define ALIGN 4
+
+#define FNV_INIT 2166136261u
+#define FNV_PRIME 16777619u
+
+static guint32 _fnv(guint32 h, const void *data, gsize len)
+{
+	gsize i;
+	const guint8 *d = data;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ d[i]) * FNV_PRIME;
+	}
+
+	return h;
+}
+
+/**
+ * Images hold compiled key codes, so they're only good for the key table they
+ * were compiled against.
+ */
+static guint32 _keys_hash(void)
+{
+	guint i;
+	GArray *codes;
+	static guint32 h;
+	static gsize done = 0;
+
+	if (!g_once_init_enter(&done)) {
+		return h;
+	}
+
+	h = FNV_INIT;
+	codes = keys_get_all_codes();
+
+	for (i = 0; i < codes->len; i++) {
+		int code = g_array_index(codes, int, i);
+		const char *name = keys_val(code);
+
+		h = _fnv(h, &code, sizeof(code));
+		h = _fnv(h, name, strlen(name) + 1);
+	}
+
+	g_array_free(codes, TRUE);
+	g_once_init_leave(&done, 1);
+
+	return h;
+}
+
+static gint64 _mtime(const struct stat *st)
+{
+	return ((gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000)) +
+		st->st_mtim.tv_nsec;
+}
+
+struct cache* cache_open(const char *path, const struct stat *src)
+{
+	gsize size;
+	struct cache *c;
+	guint8 *base;
+	GMappedFile *map;
+	const struct cache_header *hdr;
+
+	map = g_mapped_file_new(path, TRUE, NULL);
+	if (map == NULL) {
+		return NULL;
+	}
+
+	base = (guint8*)g_mapped_file_get_contents(map);
+	size = g_mapped_file_get_length(map);
+	hdr = (const struct cache_header*)base;
+
+	if (base == NULL ||
+		size < sizeof(*hdr) ||
+		memcmp(hdr->magic, MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != CACHE_VERSION ||
+		hdr->keys != _keys_hash() ||
+		hdr->size != size ||
+		hdr->src_mtime != _mtime(src) ||
+		hdr->src_size != src->st_size ||
+		hdr->hash != _fnv(FNV_INIT, base + sizeof(*hdr), size - sizeof(*hdr))) {
+
+		log_debug("ignoring stale cache %s", path);
+		g_mapped_file_unref(map);
+		return NULL;
+	}
+
+	c = g_malloc0(sizeof(*c));
+	c->map = map;
+	c->base = base;
+	c->size = size;
+	c->root = hdr->root;
+
+	return c;
+}
+
+void cache_free(struct cache *c)
+{
+	if (c == NULL) {
+		return;
+	}
+
+	g_mapped_file_unref(c->map);
+	g_free(c);
+}
+
+const void* cache_at(const struct cache *c, gsize off, gsize len)
+{
+	if (off < sizeof(struct cache_header) ||
+		off % ALIGN != 0 ||
+		off > c->size ||
+		len > c->size - off) {
+		return NULL;
+	}
+
+	return c->base + off;
+}
+
+char* cache_str(const struct cache *c, gsize off)
+{
+	if (off < sizeof(struct cache_header) || off >= c->size) {
+		return NULL;
+	}
+
+	if (memchr(c->base + off, '\0', c->size - off) == NULL) {
+		return NULL;
+	}
+
+	return (char*)c->base + off;
+}
+
+GByteArray* cache_builder_new(void)
+{
+	GByteArray *b = g_byte_array_sized_new(4096);
+
+	g_byte_array_set_size(b, sizeof(struct cache_header));
+	memset(b->data, 0, b->len);
+
+	return b;
+}
+
+guint32 cache_append(GByteArray *b, const void *data, gsize len)
+{
+	guint32 off;
+	static const guint8 pad[ALIGN] = { 0 };
+
+	if (b->len % ALIGN != 0) {
+		g_byte_array_append(b, pad, ALIGN - (b->len % ALIGN));
+	}
+
+	off = b->len;
+	g_byte_array_append(b, data, len);
+
+	return off;
+}
+
+guint32 cache_append_str(GByteArray *b, const char *s)
+{
+	return cache_append(b, s, strlen(s) + 1);
+}
+
+void cache_save(GByteArray *b, guint32 root, const char *path, const struct stat *src)
+{
+	gboolean ok;
+	GError *error = NULL;
+	struct cache_header *hdr = (struct cache_header*)b->data;
+
+	memcpy(hdr->magic, MAGIC, sizeof(hdr->magic));
+	hdr->version = CACHE_VERSION;
+	hdr->keys = _keys_hash();
+	hdr->size = b->len;
+	hdr->root = root;
+	hdr->src_mtime = _mtime(src);
+	hdr->src_size = src->st_size;
+	hdr->hash = _fnv(FNV_INIT, b->data + sizeof(*hdr), b->len - sizeof(*hdr));
+
+	ok = g_file_set_contents(path, (const char*)b->data, b->len, &error);
+	if (!ok) {
+		log_debug("failed to write cache %s: %s", path, error->message);
+		g_clear_error(&error);
+	}
+
+	g_byte_array_free(b, TRUE);
+}
@@ -0,0 +1,116 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+#include <sys/stat.h>
+
+/**
+ * Bump whenever the layout of anything written into a cache changes
+ */
+#define CACHE_VERSION 3
+
+/**
+ * Start of every cache image. All offsets in an image are from its start, so
+ * an image can be used wherever it's mapped; 0 is never a valid offset.
+ */
+struct cache_header {
+	char magic[8];
+	guint32 version;
+
+	/**
+	 * Hash of the key table the image was compiled against
+	 */
+	guint32 keys;
+
+	/**
+	 * Size of the whole image
+	 */
+	guint32 size;
+
+	/**
+	 * Hash of everything after the header
+	 */
+	guint32 hash;
+
+	/**
+	 * Offset of the top-level object
+	 */
+	guint32 root;
+	guint32 _pad;
+
+	/**
+	 * The source file the image was compiled from, as it was at the time
+	 */
+	gint64 src_mtime;
+	gint64 src_size;
+};
+
+/**
+ * A mapped, validated cache image. It's mapped privately and writable, so
+ * that strings can be handed out as-is to things that expect a plain char*;
+ * nothing ever writes to it.
+ */
+struct cache {
+	GMappedFile *map;
+	guint8 *base;
+	gsize size;
+	guint32 root;
+};
+
+/**
+ * Map the cache at `path`. Returns NULL if there isn't one, or if it's not a
+ * valid image of `src` as it is now.
+ */
+struct cache* cache_open(const char *path, const struct stat *src);
+
+/**
+ * Unmap a cache. Anything pointing into it goes with it.
+ */
+void cache_free(struct cache *c);
+
+/**
+ * Get `len` bytes at `off`, or NULL if they're not all inside the image
+ */
+const void* cache_at(const struct cache *c, gsize off, gsize len);
+
+/**
+ * Get the string at `off`, or NULL if it runs off the end of the image
+ */
+char* cache_str(const struct cache *c, gsize off);
+
+/**
+ * Start building a new image
+ */
+GByteArray* cache_builder_new(void);
+
+/**
+ * Append to an image, returning the (aligned) offset it was written at
+ */
+guint32 cache_append(GByteArray *b, const void *data, gsize len);
+
+/**
+ * Append a string, NUL and all
+ */
+guint32 cache_append_str(GByteArray *b, const char *s);
+
+/**
+ * Finish an image and write it to `path`, stamped with `src`. Frees the
+ * builder.
+ */
+void cache_save(GByteArray *b, guint32 root, const char *path, const struct stat *src);
@@ -17,20 +17,26 @@
  */
 
 #include "callbacks.h"
+#include "config.h"
+#include "control.h"
+#include "effects.h"
 #include "layout.h"
 #include "proc.h"
 #include "state.h"
+#include "status.h"
 #include "usb.h"
 
 static void _state_changed(void)
 {
+	effects_on_state_changed();
 	usb_on_state_changed();
+	control_on_state_changed();
+	status_on_state_changed();
 }
 
 void cbs_poll_tick()
 {
 	proc_on_poll_tick();
-	usb_on_poll_tick();
 
 	cbs_check_state();
 }
@@ -48,6 +54,7 @@ void cbs_config_updated()
 
 void cbs_prog_start()
 {
+	cfg_on_prog_start();
 	layout_on_prog_start();
 
 	cbs_check_state();
@@ -68,3 +75,8 @@ void cbs_check_state()
 
 	_state_changed();
 }
+
+void cbs_key_press()
+{
+	effects_on_key_press();
+}
@@ -47,3 +47,8 @@ void cbs_state_changed(void);
  * Change was (maybe?) updated
  */
 void cbs_check_state(void);
+
+/**
+ * A mapped key on the device was pressed
+ */
+void cbs_key_press(void);
@@ -22,278 +22,1647 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wordexp.h>
+#include "arena.h"
+#include "cache.h"
 #include "callbacks.h"
 #include "config.h"
+#include "effects.h"
 #include "keys.h"
+#include "log.h"
+#include "metrics.h"
 #include "poll.h"
+#include "state.h"
+#include "trace.h"
 #include "udev.h"
 
 #define INDENT "    "
 
+/**
+ * How long the config dir has to be quiet before a reload, in ms. Editors
+ * tend to write swap files, rename and re-save in quick succession.
+ */
+#define DEBOUNCE 100
+
+/**
+ * The longest a steady stream of changes can hold off a reload, in ms
+ */
+#define DEBOUNCE_MAX 1000
+
+/**
+ * How many programs keep their layouts loaded after they stop running
+ */
+#define LRU_SIZE 4
+
+/**
+ * A key binding from an ini file, kept as written until it's needed
+ */
+struct bind {
+	guint key;
+	char *combo;
+};
+
+/**
+ * Where a layout comes from. Layouts are only parsed once their program
+ * runs, so reloads only have to deal with program headers.
+ */
+struct layout_src {
+	guint id;
+
+	/**
+	 * From an ini file: bindings that override the defaults, in order
+	 */
+	GArray *binds;
+
+	/**
+	 * From a cache: the compiled layout's offset in the image
+	 */
+	const struct cache *cache;
+	guint32 off;
+};
+
+/**
+ * A program as found in one file, before it's merged with the others
+ */
+struct frag {
+	char *name;
+	GPtrArray *cmds;
+	GPtrArray *exes;
+	GPtrArray *layout_srcs;
+};
+
+/**
+ * Everything parsed out of a single file in the config dir
+ */
+struct cfg_file {
+	/**
+	 * Held by the file cache and by every generation built from the file
+	 */
+	gint refs;
+
+	/**
+	 * Program fragments, merged with all other files into cfg.programs
+	 */
+	GPtrArray *programs;
+
+	/**
+	 * Values from [default], NULL when the file doesn't set them
+	 */
+	char *backlight;
+	char *effects;
+
+	/**
+	 * When loaded from a compiled cache, the image that strings point into
+	 */
+	struct cache *cache;
+};
+
+/**
+ * Compiled form of a struct cfg_file, as the root of a cache image. Offsets
+ * are into the image, and 0 means unset.
+ */
+struct cache_file {
+	guint32 backlight;
+	guint32 effects;
+	guint32 programs_len;
+
+	/**
+	 * guint32[programs_len] of struct cache_program
+	 */
+	guint32 programs;
+};
+
+struct cache_program {
+	guint32 name;
+
+	/**
+	 * guint32[] of strings
+	 */
+	guint32 cmds_len;
+	guint32 cmds;
+	guint32 exes_len;
+	guint32 exes;
+
+	/**
+	 * guint32[] of struct cache_layout
+	 */
+	guint32 layouts_len;
+	guint32 layouts;
+};
+
+/**
+ * Combos are stored as struct combo, exactly as they're emitted, and used
+ * straight out of the image. Identical combos are only stored once.
+ */
+struct cache_layout {
+	guint32 id;
+	guint32 combos[G_N_ELEMENTS(((struct layout*)NULL)->combos)];
+};
+
+/**
+ * One complete, merged config. Every reload builds a new generation off the
+ * main loop, which is then swapped in whole.
+ */
+struct cfg_gen {
+	gint refs;
+	GPtrArray *programs;
+	enum usb_backlight backlight;
+	guint effects;
+
+	/**
+	 * Files that programs borrow their strings and layouts from
+	 */
+	GPtrArray *files;
+
+	/**
+	 * Programs, layouts and combos all come from here, and go with it
+	 */
+	struct arena *arena;
+
+	/**
+	 * Every combo parsed into the arena, so each is only stored once
+	 */
+	GHashTable *combos;
+
+	/**
+	 * Layouts that were unloaded, waiting to be reused
+	 */
+	GPtrArray *spare;
+};
+
+/**
+ * File name -> struct cfg_file, for every file in the config dir. Only ever
+ * touched by whoever's building generations: cfg_init() at startup, the
+ * worker after.
+ */
+static GHashTable *_files;
+
+/**
+ * Guards everything shared between the main loop and the worker, below
+ */
+static GMutex _lock;
+static GCond _wake;
+
+/**
+ * Names of files touched since the last reload
+ */
+static GHashTable *_changed;
+
+/**
+ * If inotify lost track, so everything has to be reread
+ */
+static gboolean _rescan;
+
+/**
+ * If the worker has been asked to reload
+ */
+static gboolean _pending;
+
+/**
+ * A generation the worker finished, waiting to be published
+ */
+static struct cfg_gen *_ready;
+
+/**
+ * Written by the worker when _ready is set
+ */
+static int _ready_fd;
+
+/**
+ * The generation cfg currently points into
+ */
+static struct cfg_gen *_gen;
+
+/**
+ * Programs from the current generation that have their layouts loaded, most
+ * recently started first. Main loop only.
+ */
+static GQueue _lru = G_QUEUE_INIT;
+
+/**
+ * The default combo for every key, shared by all layouts
+ */
+static const struct combo *_defaults[G_N_ELEMENTS(((struct layout*)NULL)->combos)];
+
+/**
+ * When the first change since the last reload came in, in ms
+ */
+static gint64 _first_change;
+
+static struct poll_timer *_debounce;
+
 static void _print_opt(const char *s, const char *arg, const char *desc)
 {
-	printf(INDENT);
+	printf(INDENT);
+
+	if (s != NULL) {
+		printf("-%s, ", s);
+	}
+
+	printf("--%s\n", arg);
+	printf(INDENT INDENT "%s\n", desc);
+}
+
+static void _print_usage(char **argv)
+{
+	printf("Usage: %s [OPTION]...\n", argv[0]);
+	printf("\n");
+	_print_opt("aGROUP", "authorize=GROUP", "add a udev rule to allow the given group to access the device without root");
+	_print_opt("cDIR", "config-dir=DIR", "directory to use for config files (~/.config/lintartarus)");
+	_print_opt(NULL, "control=PATH", "serve the control socket at PATH ($XDG_RUNTIME_DIR/lintartarus.sock)");
+	_print_opt(NULL, "dump-config", "dump parse config values");
+	_print_opt("h", "help", "print this message");
+	_print_opt("mPATH", "metrics=PATH", "serve metrics on a UNIX socket at PATH ($XDG_RUNTIME_DIR/lintartarus-metrics.sock)");
+	_print_opt(NULL, "status=PATH", "publish the status page at PATH ($XDG_RUNTIME_DIR/lintartarus-status)");
+	_print_opt(NULL, "tap=PATH", "publish every key event and what it was mapped to at PATH ($XDG_RUNTIME_DIR/lintartarus-tap)");
+	_print_opt("sMS", "stall-budget=MS", "log any event handler that holds up the main loop for longer than this (50); 0 to never log");
+
+	exit(2);
+}
+
+static void _set_config_dir(const char *dir)
+{
+	int err;
+	wordexp_t p;
+
+	err = wordexp(dir, &p, WRDE_UNDEF);
+	if (err != 0) {
+		const char *strerr;
+		switch (err) {
+			case WRDE_BADCHAR:
+				strerr = "Illegal occurrence of newline or one of "
+					"|, &, ;, <, >, (, ), {, }.";
+				break;
+			case WRDE_BADVAL:
+				strerr = "An undefined shell variable was referenced";
+				break;
+			case WRDE_NOSPACE:
+				strerr = "Out of memory";
+				break;
+			case WRDE_SYNTAX:
+				strerr = "Syntax error in expansion";
+				break;
+			default:
+				strerr = "unknown";
+				break;
+		}
+
+		g_error("invalid config directory: %s", strerr);
+	}
+
+	cfg.config_dir = g_strdup(p.we_wordv[0]);
+	wordfree(&p);
+}
+
+static int _strcmp(const void *a_, const void *b_)
+{
+	const char * const *a = a_;
+	const char * const *b = b_;
+	return g_strcmp0(*a, *b);
+}
+
+static guint _combo_hash(gconstpointer combo)
+{
+	return keys_combo_hash(combo);
+}
+
+static gboolean _combo_equal(gconstpointer a, gconstpointer b)
+{
+	gsize len = keys_combo_size(a);
+	return len == keys_combo_size(b) && memcmp(a, b, len) == 0;
+}
+
+static void _defaults_init(void)
+{
+	guint i;
+	union combo_buf buf;
+
+	for (i = 0; i < G_N_ELEMENTS(_defaults); i++) {
+		if (!keys_parse(keys_get_dev_default(i), &buf)) {
+			g_error("default layout parsing failed. this is a programmer bug.");
+		}
+
+		_defaults[i] = g_memdup(&buf.combo, keys_combo_size(&buf.combo));
+	}
+}
+
+/**
+ * Get the generation's copy of a combo
+ */
+static const struct combo* _intern(struct cfg_gen *gen, const struct combo *combo)
+{
+	struct combo *c = g_hash_table_lookup(gen->combos, combo);
+
+	if (c == NULL) {
+		c = arena_dup(gen->arena, combo, keys_combo_size(combo));
+		g_hash_table_add(gen->combos, c);
+	}
+
+	return c;
+}
+
+/**
+ * Get a layout with all keys bound to their defaults
+ */
+static struct layout* _layout_new(struct cfg_gen *gen)
+{
+	struct layout *l;
+
+	if (gen->spare->len > 0) {
+		l = g_ptr_array_remove_index_fast(gen->spare, gen->spare->len - 1);
+	} else {
+		l = arena_alloc(gen->arena, sizeof(*l));
+	}
+
+	memcpy(l->combos, _defaults, sizeof(l->combos));
+
+	return l;
+}
+
+static void _src_free(void *src_)
+{
+	guint i;
+	struct layout_src *src = src_;
+
+	if (src->binds != NULL) {
+		for (i = 0; i < src->binds->len; i++) {
+			g_free(g_array_index(src->binds, struct bind, i).combo);
+		}
+
+		g_array_free(src->binds, TRUE);
+	}
+
+	g_free(src);
+}
+
+static int _src_cmp(const void *a_, const void *b_)
+{
+	const struct layout_src * const *a = a_;
+	const struct layout_src * const *b = b_;
+	return (*a)->id - (*b)->id;
+}
+
+/**
+ * Parse a layout from the bindings in an ini file
+ */
+static struct layout* _layout_compile(struct cfg_gen *gen, const struct layout_src *src)
+{
+	guint i;
+	union combo_buf buf;
+	struct layout *l = _layout_new(gen);
+
+	l->id = src->id;
+
+	for (i = 0; i < src->binds->len; i++) {
+		struct bind *b = &g_array_index(src->binds, struct bind, i);
+
+		if (keys_parse(b->combo, &buf)) {
+			l->combos[b->key] = _intern(gen, &buf.combo);
+		}
+	}
+
+	return l;
+}
+
+static void _frag_free(void *frag_)
+{
+	struct frag *frag = frag_;
+	g_ptr_array_free(frag->cmds, TRUE);
+	g_ptr_array_free(frag->exes, TRUE);
+	g_ptr_array_free(frag->layout_srcs, TRUE);
+	g_free(frag->name);
+	g_free(frag);
+}
+
+static int _frag_cmp(const void *a_, const void *b_)
+{
+	const struct frag * const *a = a_;
+	const struct frag * const *b = b_;
+	return g_strcmp0((*a)->name, (*b)->name);
+}
+
+/**
+ * Create a fragment. The free funcs say whether it owns its strings and
+ * layout sources or borrows them from elsewhere.
+ */
+static struct frag* _frag_new(
+	const char *name,
+	GDestroyNotify str_free,
+	GDestroyNotify src_free)
+{
+	struct frag *frag = g_malloc0(sizeof(*frag));
+
+	frag->name = g_strdup(name);
+	frag->cmds = g_ptr_array_new_with_free_func(str_free);
+	frag->exes = g_ptr_array_new_with_free_func(str_free);
+	frag->layout_srcs = g_ptr_array_new_with_free_func(src_free);
+
+	return frag;
+}
+
+static struct cfg_file* _file_new(void)
+{
+	struct cfg_file *f = g_malloc0(sizeof(*f));
+
+	f->refs = 1;
+	f->programs = g_ptr_array_new_with_free_func(_frag_free);
+
+	return f;
+}
+
+static struct cfg_file* _file_ref(struct cfg_file *f)
+{
+	g_atomic_int_inc(&f->refs);
+	return f;
+}
+
+static void _file_unref(void *f_)
+{
+	struct cfg_file *f = f_;
+
+	if (!g_atomic_int_dec_and_test(&f->refs)) {
+		return;
+	}
+
+	g_ptr_array_free(f->programs, TRUE);
+	g_free(f->backlight);
+	g_free(f->effects);
+	cache_free(f->cache);
+	g_free(f);
+}
+
+/**
+ * Parser state for one config file. Sections are applied as they're read,
+ * so nothing more than the current line is ever held in memory.
+ */
+struct parser {
+	const char *path;
+	guint line;
+	struct cfg_file *f;
+
+	/**
+	 * Program name -> struct frag, for programs in this file
+	 */
+	GHashTable *index;
+
+	/**
+	 * What the current section applies to. In a section with none of these
+	 * set, values are ignored.
+	 */
+	gboolean in_section;
+	gboolean defaults;
+	struct frag *prog;
+	struct layout_src *src;
+};
+
+/**
+ * Undo GKeyFile-style escapes, in place
+ */
+static char* _unescape(char *val)
+{
+	char *r;
+	char *w;
+
+	for (r = w = val; *r != '\0'; r++, w++) {
+		if (*r != '\\' || *(r + 1) == '\0') {
+			*w = *r;
+			continue;
+		}
+
+		switch (*++r) {
+			case 's': *w = ' '; break;
+			case 'n': *w = '\n'; break;
+			case 't': *w = '\t'; break;
+			case 'r': *w = '\r'; break;
+			default:  *w = *r; break;
+		}
+	}
+
+	*w = '\0';
+
+	return val;
+}
+
+static void _parse_section(struct parser *p, char *name)
+{
+	guint i;
+	guint id;
+	char *end;
+	char *layout_id;
+	struct frag *prog;
+	struct layout_src *src;
+
+	p->in_section = TRUE;
+	p->defaults = FALSE;
+	p->prog = NULL;
+	p->src = NULL;
+
+	if (g_str_equal(name, "default")) {
+		p->defaults = TRUE;
+		return;
+	}
+
+	layout_id = strchr(name, ':');
+	if (layout_id != NULL) {
+		*layout_id++ = '\0';
+	}
+
+	prog = g_hash_table_lookup(p->index, name);
+	if (prog == NULL) {
+		prog = _frag_new(name, g_free, _src_free);
+		g_ptr_array_add(p->f->programs, prog);
+		g_hash_table_insert(p->index, prog->name, prog);
+	}
+
+	if (layout_id == NULL) {
+		p->prog = prog;
+		return;
+	}
+
+	id = g_ascii_strtoull(layout_id, &end, 10);
+	if (*layout_id == '\0' || *end != '\0') {
+		g_critical("ignoring invalid layout id for %s: %s",
+			name,
+			layout_id);
+		return;
+	}
+
+	for (i = 0; i < prog->layout_srcs->len; i++) {
+		src = g_ptr_array_index(prog->layout_srcs, i);
+		if (src->id == id) {
+			p->src = src;
+			return;
+		}
+	}
+
+	src = g_malloc0(sizeof(*src));
+	src->id = id;
+	src->binds = g_array_new(FALSE, FALSE, sizeof(struct bind));
+	g_ptr_array_add(prog->layout_srcs, src);
+
+	p->src = src;
+}
+
+static void _parse_value(struct parser *p, const char *key, const char *val)
+{
+	guint i;
+	char **dst = NULL;
+
+	if (p->defaults) {
+		if (g_str_equal(key, "backlight")) {
+			dst = &p->f->backlight;
+		} else if (g_str_equal(key, "effects")) {
+			dst = &p->f->effects;
+		}
+
+		if (dst != NULL) {
+			g_free(*dst);
+			*dst = g_strdup(val);
+		}
+	} else if (p->prog != NULL) {
+		if (g_str_has_prefix(key, "cmd")) {
+			g_ptr_array_add(p->prog->cmds, g_strdup(val));
+		} else if (g_str_has_prefix(key, "exe")) {
+			g_ptr_array_add(p->prog->exes, g_strdup(val));
+		}
+	} else if (p->src != NULL) {
+		for (i = 0; i < G_N_ELEMENTS(((struct layout*)NULL)->combos); i++) {
+			if (g_str_equal(key, keys_get_dev_name(i))) {
+				struct bind b = {
+					.key = i,
+					.combo = g_strdup(val),
+				};
+
+				g_array_append_val(p->src->binds, b);
+				break;
+			}
+		}
+	}
+}
+
+static gboolean _parse_line(struct parser *p, char *line)
+{
+	gsize len;
+	char *eq;
+
+	line = g_strstrip(line);
+	len = strlen(line);
+
+	if (len == 0 || *line == '#') {
+		return TRUE;
+	}
+
+	if (*line == '[') {
+		if (line[len - 1] != ']') {
+			g_critical("%s:%u: unterminated section name", p->path, p->line);
+			return FALSE;
+		}
+
+		line[len - 1] = '\0';
+		_parse_section(p, line + 1);
+		return TRUE;
+	}
+
+	eq = strchr(line, '=');
+	if (eq == NULL) {
+		g_critical("%s:%u: expected \"key = value\"", p->path, p->line);
+		return FALSE;
+	}
+
+	if (!p->in_section) {
+		g_critical("%s:%u: value outside of any section", p->path, p->line);
+		return FALSE;
+	}
+
+	*eq = '\0';
+	_parse_value(p, g_strchomp(line), _unescape(g_strchug(eq + 1)));
+
+	return TRUE;
+}
+
+/**
+ * Merge a file's fragments into a generation's fragments. Strings and layouts
+ * are borrowed from the file, so merged fragments don't free them. A layout
+ * defined in more than one file is taken from the last one.
+ */
+static void _merge_file(GPtrArray *progs, struct cfg_file *f, GHashTable *index)
+{
+	guint i;
+	guint j;
+	guint k;
+
+	for (i = 0; i < f->programs->len; i++) {
+		struct frag *frag = g_ptr_array_index(f->programs, i);
+		struct frag *prog = g_hash_table_lookup(index, frag->name);
+
+		if (prog == NULL) {
+			prog = _frag_new(frag->name, NULL, NULL);
+			g_ptr_array_add(progs, prog);
+			g_hash_table_insert(index, prog->name, prog);
+		}
+
+		for (j = 0; j < frag->cmds->len; j++) {
+			g_ptr_array_add(prog->cmds, g_ptr_array_index(frag->cmds, j));
+		}
+
+		for (j = 0; j < frag->exes->len; j++) {
+			g_ptr_array_add(prog->exes, g_ptr_array_index(frag->exes, j));
+		}
+
+		for (j = 0; j < frag->layout_srcs->len; j++) {
+			struct layout_src *src = g_ptr_array_index(frag->layout_srcs, j);
+
+			for (k = 0; k < prog->layout_srcs->len; k++) {
+				struct layout_src *ps = g_ptr_array_index(prog->layout_srcs, k);
+				if (ps->id == src->id) {
+					break;
+				}
+			}
+
+			if (k < prog->layout_srcs->len) {
+				g_ptr_array_index(prog->layout_srcs, k) = src;
+			} else {
+				g_ptr_array_add(prog->layout_srcs, src);
+			}
+		}
+	}
+}
+
+static guint _parse_effects(const char *val)
+{
+	guint i;
+	char **names;
+	guint effects = 0;
+
+	if (val == NULL) {
+		return 0;
+	}
+
+	names = g_strsplit_set(val, ", \t", 0);
+	for (i = 0; names[i] != NULL; i++) {
+		if (*names[i] == '\0' || g_str_equal(names[i], "none")) {
+			continue;
+		} else if (g_str_equal(names[i], "fade")) {
+			effects |= effect_fade;
+		} else if (g_str_equal(names[i], "flash")) {
+			effects |= effect_flash;
+		} else if (g_str_equal(names[i], "activity")) {
+			effects |= effect_activity;
+		} else {
+			g_critical("ignoring unknown effect: %s", names[i]);
+		}
+	}
+
+	g_strfreev(names);
+
+	return effects;
+}
+
+static enum usb_backlight _parse_backlight(const char *backlight)
+{
+	if (g_strcmp0(backlight, "off") == 0) {
+		return backlight_off;
+	} else if (g_strcmp0(backlight, "low") == 0) {
+		return backlight_low;
+	} else if (g_strcmp0(backlight, "med") == 0) {
+		return backlight_med;
+	} else if (g_strcmp0(backlight, "high") == 0) {
+		return backlight_high;
+	} else if (g_strcmp0(backlight, "pulse") == 0) {
+		return backlight_pulse;
+	}
+
+	g_critical("invalid backlight config, defaulting to low");
+	return backlight_low;
+}
+
+static void _gen_unref(struct cfg_gen *gen)
+{
+	if (!g_atomic_int_dec_and_test(&gen->refs)) {
+		return;
+	}
+
+	g_ptr_array_free(gen->programs, TRUE);
+	g_ptr_array_free(gen->files, TRUE);
+	g_ptr_array_free(gen->spare, TRUE);
+	g_hash_table_destroy(gen->combos);
+	arena_free(gen->arena);
+	g_free(gen);
+}
+
+/**
+ * Find a program in a sorted list
+ */
+static int _program_index(GPtrArray *progs, const char *name)
+{
+	int cmp;
+	guint mid;
+	guint lo = 0;
+	guint hi = progs->len;
+
+	while (lo < hi) {
+		struct program *prog;
+
+		mid = lo + ((hi - lo) / 2);
+		prog = g_ptr_array_index(progs, mid);
+		cmp = g_strcmp0(prog->name, name);
+
+		if (cmp == 0) {
+			return mid;
+		} else if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Copy a list of borrowed strings into a NULL-terminated, sorted array in the
+ * generation's arena
+ */
+static char** _gen_strv(struct cfg_gen *gen, GPtrArray *strs)
+{
+	guint i;
+	char **strv = arena_alloc(gen->arena, sizeof(*strv) * (strs->len + 1));
+
+	g_ptr_array_sort(strs, _strcmp);
+	for (i = 0; i < strs->len; i++) {
+		strv[i] = arena_strdup(gen->arena, g_ptr_array_index(strs, i));
+	}
+
+	return strv;
+}
+
+/**
+ * Turn a merged fragment into one of the generation's programs
+ */
+static struct program* _gen_program(struct cfg_gen *gen, struct frag *frag)
+{
+	guint i;
+	guint next_layout;
+	struct program *prog = arena_alloc(gen->arena, sizeof(*prog));
+
+	prog->name = arena_strdup(gen->arena, frag->name);
+	prog->cmds = _gen_strv(gen, frag->cmds);
+	prog->exes = _gen_strv(gen, frag->exes);
+
+	g_ptr_array_sort(frag->layout_srcs, _src_cmp);
+
+	if (frag->layout_srcs->len > 7) {
+		g_warning("found more than 7 layouts for %s; ignoring the extras",
+			prog->name);
+		g_ptr_array_set_size(frag->layout_srcs, 7);
+	}
+
+	prog->layouts_len = frag->layout_srcs->len;
+	prog->layout_srcs = arena_dup(gen->arena,
+		frag->layout_srcs->pdata,
+		sizeof(*prog->layout_srcs) * prog->layouts_len);
+	prog->layouts = arena_alloc(gen->arena,
+		sizeof(*prog->layouts) * prog->layouts_len);
+
+	for (next_layout = 1, i = 0; i < prog->layouts_len; i++, next_layout++) {
+		if (prog->layout_srcs[i]->id != next_layout) {
+			g_warning("for %s, missing layout #%d; "
+				"your layouts won't function as expected",
+				prog->name,
+				next_layout);
+		}
+	}
+
+	return prog;
+}
+
+/**
+ * Build a new generation from the cached files. Files are merged in name
+ * order so that, when two set the same thing, the result doesn't depend on
+ * directory order.
+ */
+static struct cfg_gen* _build_progs(void)
+{
+	guint i;
+	GList *names;
+	GList *name;
+	GHashTable *index;
+	GPtrArray *frags;
+	const char *backlight = NULL;
+	const char *effects = NULL;
+	struct cfg_gen *gen = g_malloc0(sizeof(*gen));
+
+	gen->refs = 1;
+	gen->files = g_ptr_array_new_with_free_func(_file_unref);
+	gen->arena = arena_new();
+	gen->combos = g_hash_table_new(_combo_hash, _combo_equal);
+	gen->spare = g_ptr_array_new();
+	frags = g_ptr_array_new_with_free_func(_frag_free);
+	index = g_hash_table_new(g_str_hash, g_str_equal);
+
+	names = g_list_sort(g_hash_table_get_keys(_files), (GCompareFunc)g_strcmp0);
+	for (name = names; name != NULL; name = name->next) {
+		struct cfg_file *f = g_hash_table_lookup(_files, name->data);
+
+		if (f->backlight != NULL) {
+			backlight = f->backlight;
+		}
+
+		if (f->effects != NULL) {
+			effects = f->effects;
+		}
+
+		g_ptr_array_add(gen->files, _file_ref(f));
+		_merge_file(frags, f, index);
+	}
+
+	g_list_free(names);
+	g_hash_table_destroy(index);
+
+	gen->backlight = _parse_backlight(backlight);
+	gen->effects = _parse_effects(effects);
+
+	g_ptr_array_sort(frags, _frag_cmp);
+	gen->programs = g_ptr_array_sized_new(frags->len);
+	for (i = 0; i < frags->len; i++) {
+		g_ptr_array_add(gen->programs,
+			_gen_program(gen, g_ptr_array_index(frags, i)));
+	}
+
+	g_ptr_array_free(frags, TRUE);
+
+	return gen;
+}
+
+/**
+ * Editor droppings that never hold config
+ */
+static gboolean _ignored(const char *name)
+{
+	return *name == '.' ||
+		g_str_has_suffix(name, "~") ||
+		g_str_has_suffix(name, ".swp") ||
+		g_str_has_suffix(name, ".swx") ||
+		g_str_has_suffix(name, ".tmp");
+}
+
+static void _ensure_default(GHashTable *changed)
+{
+	int err;
+	char *path;
+	gboolean ok;
+	GError *error = NULL;
+
+	if (!g_file_test(cfg.config_dir, G_FILE_TEST_IS_DIR)) {
+		err = g_mkdir_with_parents(cfg.config_dir, 0700);
+		if (err != 0) {
+			g_error("failed to create %s: %s",
+				cfg.config_dir,
+				strerror(errno));
+		}
+	}
+
+	path = g_strdup_printf("%s/%s", cfg.config_dir, "config.ini");
+	if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+		ok = g_file_set_contents(path, DEFAULT_CONFIG, -1, &error);
+		if (!ok) {
+			g_error("failed to create default config: %s", error->message);
+		}
+
+		g_hash_table_add(changed, g_strdup("config.ini"));
+	}
+
+	g_free(path);
+}
+
+static guint32 _cache_strv(GByteArray *b, GPtrArray *strs)
+{
+	guint i;
+	guint32 off;
+	GArray *offs = g_array_sized_new(FALSE, FALSE, sizeof(guint32), strs->len);
+
+	for (i = 0; i < strs->len; i++) {
+		off = cache_append_str(b, g_ptr_array_index(strs, i));
+		g_array_append_val(offs, off);
+	}
+
+	off = cache_append(b, offs->data, offs->len * sizeof(guint32));
+	g_array_free(offs, TRUE);
+
+	return off;
+}
+
+/**
+ * Write a combo, unless the image already has it
+ */
+static guint32 _cache_combo(GByteArray *b, GHashTable *offs, const struct combo *combo)
+{
+	gsize len = keys_combo_size(combo);
+	guint32 off = GPOINTER_TO_UINT(g_hash_table_lookup(offs, combo));
+
+	if (off == 0) {
+		off = cache_append(b, combo, len);
+		g_hash_table_insert(offs, g_memdup(combo, len), GUINT_TO_POINTER(off));
+	}
+
+	return off;
+}
+
+static guint32 _cache_layout(
+	GByteArray *b,
+	GHashTable *offs,
+	const struct layout_src *src)
+{
+	guint i;
+	union combo_buf buf;
+	struct cache_layout cl;
+
+	cl.id = src->id;
+	for (i = 0; i < G_N_ELEMENTS(cl.combos); i++) {
+		cl.combos[i] = _cache_combo(b, offs, _defaults[i]);
+	}
+
+	for (i = 0; i < src->binds->len; i++) {
+		struct bind *bind = &g_array_index(src->binds, struct bind, i);
+
+		if (keys_parse(bind->combo, &buf)) {
+			cl.combos[bind->key] = _cache_combo(b, offs, &buf.combo);
+		}
+	}
+
+	return cache_append(b, &cl, sizeof(cl));
+}
+
+static void _cache_save(struct cfg_file *f, const char *path, const struct stat *st)
+{
+	guint i;
+	guint j;
+	guint32 off;
+	struct cache_file cf;
+	GArray *progs = g_array_new(FALSE, FALSE, sizeof(guint32));
+	GArray *layouts = g_array_new(FALSE, FALSE, sizeof(guint32));
+	GHashTable *offs = g_hash_table_new_full(_combo_hash, _combo_equal, g_free, NULL);
+	GByteArray *b = cache_builder_new();
+
+	memset(&cf, 0, sizeof(cf));
+
+	for (i = 0; i < f->programs->len; i++) {
+		struct cache_program cp;
+		struct frag *prog = g_ptr_array_index(f->programs, i);
+
+		g_array_set_size(layouts, 0);
+		for (j = 0; j < prog->layout_srcs->len; j++) {
+			off = _cache_layout(b, offs, g_ptr_array_index(prog->layout_srcs, j));
+			g_array_append_val(layouts, off);
+		}
+
+		cp.name = cache_append_str(b, prog->name);
+		cp.cmds_len = prog->cmds->len;
+		cp.cmds = _cache_strv(b, prog->cmds);
+		cp.exes_len = prog->exes->len;
+		cp.exes = _cache_strv(b, prog->exes);
+		cp.layouts_len = layouts->len;
+		cp.layouts = cache_append(b, layouts->data, layouts->len * sizeof(guint32));
+
+		off = cache_append(b, &cp, sizeof(cp));
+		g_array_append_val(progs, off);
+	}
+
+	if (f->backlight != NULL) {
+		cf.backlight = cache_append_str(b, f->backlight);
+	}
+
+	if (f->effects != NULL) {
+		cf.effects = cache_append_str(b, f->effects);
+	}
+
+	cf.programs_len = progs->len;
+	cf.programs = cache_append(b, progs->data, progs->len * sizeof(guint32));
+
+	cache_save(b, cache_append(b, &cf, sizeof(cf)), path, st);
+
+	g_array_free(progs, TRUE);
+	g_array_free(layouts, TRUE);
+	g_hash_table_destroy(offs);
+}
+
+/**
+ * Strings are used straight out of the image
+ */
+static gboolean _uncache_strv(
+	const struct cache *c,
+	guint32 len,
+	guint32 off,
+	GPtrArray *strs)
+{
+	guint i;
+	const guint32 *offs = cache_at(c, off, len * sizeof(*offs));
+
+	if (offs == NULL) {
+		return FALSE;
+	}
+
+	for (i = 0; i < len; i++) {
+		char *s = cache_str(c, offs[i]);
+		if (s == NULL) {
+			return FALSE;
+		}
+
+		g_ptr_array_add(strs, s);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Combos are used straight out of the image, once they're known to be
+ * well-formed
+ */
+static const struct combo* _uncache_combo(const struct cache *c, gsize off)
+{
+	guint i;
+	guint at = 0;
+	const struct combo *combo = cache_at(c, off, sizeof(*combo));
+
+	if (combo == NULL ||
+		cache_at(c, off, keys_combo_size(combo)) == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < combo->steps; i++) {
+		if (at >= combo->len ||
+			combo->codes[at] < 0 ||
+			(guint)combo->codes[at] >= combo->len - at) {
+			return NULL;
+		}
+
+		at += 1 + combo->codes[at];
+	}
+
+	return at == combo->len ? combo : NULL;
+}
+
+static struct layout* _uncache_layout(
+	struct cfg_gen *gen,
+	const struct cache *c,
+	guint32 off)
+{
+	guint i;
+	struct layout *l;
+	const struct combo *combos[G_N_ELEMENTS(l->combos)];
+	const struct cache_layout *cl = cache_at(c, off, sizeof(*cl));
+
+	if (cl == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(combos); i++) {
+		combos[i] = _uncache_combo(c, cl->combos[i]);
+		if (combos[i] == NULL) {
+			return NULL;
+		}
+	}
+
+	l = _layout_new(gen);
+	l->id = cl->id;
+	memcpy(l->combos, combos, sizeof(l->combos));
+
+	return l;
+}
+
+static struct frag* _uncache_program(const struct cache *c, guint32 off)
+{
+	guint i;
+	const char *name;
+	const guint32 *layouts;
+	struct frag *prog;
+	const struct cache_program *cp = cache_at(c, off, sizeof(*cp));
+
+	if (cp == NULL || (name = cache_str(c, cp->name)) == NULL) {
+		return NULL;
+	}
+
+	prog = _frag_new(name, NULL, _src_free);
+
+	if (!_uncache_strv(c, cp->cmds_len, cp->cmds, prog->cmds) ||
+		!_uncache_strv(c, cp->exes_len, cp->exes, prog->exes)) {
+		goto error;
+	}
+
+	layouts = cache_at(c, cp->layouts, cp->layouts_len * sizeof(*layouts));
+	if (layouts == NULL) {
+		goto error;
+	}
+
+	for (i = 0; i < cp->layouts_len; i++) {
+		struct layout_src *src;
+		const struct cache_layout *cl = cache_at(c, layouts[i], sizeof(*cl));
+
+		if (cl == NULL) {
+			goto error;
+		}
+
+		src = g_malloc0(sizeof(*src));
+		src->id = cl->id;
+		src->cache = c;
+		src->off = layouts[i];
+		g_ptr_array_add(prog->layout_srcs, src);
+	}
+
+	return prog;
+
+error:
+	_frag_free(prog);
+	return NULL;
+}
+
+/**
+ * Load a file from its compiled cache, if the cache is still good for it
+ */
+static struct cfg_file* _cache_load(const char *path, const struct stat *st)
+{
+	guint i;
+	const char *s;
+	struct cfg_file *f;
+	const guint32 *progs;
+	const struct cache_file *cf;
+	struct cache *c = cache_open(path, st);
+
+	if (c == NULL) {
+		return NULL;
+	}
 
-	if (s != NULL) {
-		printf("-%s, ", s);
+	f = _file_new();
+	f->cache = c;
+
+	cf = cache_at(c, c->root, sizeof(*cf));
+	if (cf == NULL) {
+		goto error;
 	}
 
-	printf("--%s\n", arg);
-	printf(INDENT INDENT "%s\n", desc);
+	if (cf->backlight != 0) {
+		if ((s = cache_str(c, cf->backlight)) == NULL) {
+			goto error;
+		}
+
+		f->backlight = g_strdup(s);
+	}
+
+	if (cf->effects != 0) {
+		if ((s = cache_str(c, cf->effects)) == NULL) {
+			goto error;
+		}
+
+		f->effects = g_strdup(s);
+	}
+
+	progs = cache_at(c, cf->programs, cf->programs_len * sizeof(*progs));
+	if (progs == NULL) {
+		goto error;
+	}
+
+	for (i = 0; i < cf->programs_len; i++) {
+		struct frag *prog = _uncache_program(c, progs[i]);
+		if (prog == NULL) {
+			goto error;
+		}
+
+		g_ptr_array_add(f->programs, prog);
+	}
+
+	return f;
+
+error:
+	g_critical("corrupt config cache %s, ignoring", path);
+	_file_unref(f);
+	return NULL;
 }
 
-static void _print_usage(char **argv)
+/**
+ * Parse a config file, or NULL if it couldn't be
+ */
+static struct cfg_file* _file_read(const char *path)
 {
-	printf("Usage: %s [OPTION]...\n", argv[0]);
-	printf("\n");
-	_print_opt("aGROUP", "authorize=GROUP", "add a udev rule to allow the given group to access the device without root");
-	_print_opt("cDIR", "config-dir=DIR", "directory to use for config files (~/.config/lintartarus)");
-	_print_opt(NULL, "dump-config", "dump parse config values");
-	_print_opt("h", "help", "print this message");
+	FILE *fp;
+	char *line = NULL;
+	size_t cap = 0;
+	gboolean ok = TRUE;
+	struct parser p;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT) {
+			g_critical("failed to open config \"%s\": %s",
+				path,
+				strerror(errno));
+		}
 
-	exit(2);
+		return NULL;
+	}
+
+	memset(&p, 0, sizeof(p));
+	p.path = path;
+	p.index = g_hash_table_new(g_str_hash, g_str_equal);
+	p.f = _file_new();
+
+	while (ok && getline(&line, &cap, fp) != -1) {
+		p.line++;
+		ok = _parse_line(&p, line);
+	}
+
+	if (ok && ferror(fp)) {
+		g_critical("failed to read config \"%s\": %s",
+			path,
+			strerror(errno));
+		ok = FALSE;
+	}
+
+	if (!ok) {
+		_file_unref(p.f);
+		p.f = NULL;
+	}
+
+	g_hash_table_destroy(p.index);
+	free(line);
+	fclose(fp);
+
+	return p.f;
 }
 
-static void _set_config_dir(const char *dir)
+/**
+ * Reload a single file into the cache, or drop it if it's gone. Files are
+ * loaded from their compiled form when it's up to date, and compiled after
+ * they're parsed. A file that fails to parse keeps its last good version.
+ */
+static void _load(const char *name)
 {
-	int err;
-	wordexp_t p;
+	struct stat st;
+	struct cfg_file *f;
+	char *path = g_strdup_printf("%s/%s", cfg.config_dir, name);
+	char *cpath = g_strdup_printf("%s/.%s.cache", cfg.config_dir, name);
 
-	err = wordexp(dir, &p, WRDE_UNDEF);
-	if (err != 0) {
-		const char *strerr;
-		switch (err) {
-			case WRDE_BADCHAR:
-				strerr = "Illegal occurrence of newline or one of "
-					"|, &, ;, <, >, (, ), {, }.";
-				break;
-			case WRDE_BADVAL:
-				strerr = "An undefined shell variable was referenced";
-				break;
-			case WRDE_NOSPACE:
-				strerr = "Out of memory";
-				break;
-			case WRDE_SYNTAX:
-				strerr = "Syntax error in expansion";
-				break;
-			default:
-				strerr = "unknown";
-				break;
+	if (stat(path, &st) == -1) {
+		if (errno != ENOENT) {
+			g_critical("failed to open config \"%s\": %s",
+				path,
+				strerror(errno));
 		}
 
-		g_error("invalid config directory: %s", strerr);
+		g_hash_table_remove(_files, name);
+		unlink(cpath);
+		goto out;
 	}
 
-	cfg.config_dir = g_strdup(p.we_wordv[0]);
-	wordfree(&p);
+	f = _cache_load(cpath, &st);
+	if (f == NULL) {
+		f = _file_read(path);
+		if (f != NULL) {
+			_cache_save(f, cpath, &st);
+		}
+	}
+
+	if (f != NULL) {
+		g_hash_table_replace(_files, g_strdup(name), f);
+	}
+
+out:
+	g_free(path);
+	g_free(cpath);
 }
 
-static int _strcmp(const void *a_, const void *b_)
+/**
+ * Mark every file, cached or on disk, as changed
+ */
+static void _mark_all(GHashTable *changed)
 {
-	const char * const *a = a_;
-	const char * const *b = b_;
-	return g_strcmp0(*a, *b);
+	GDir *dir;
+	const char *name;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, _files);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		g_hash_table_add(changed, g_strdup(key));
+	}
+
+	dir = g_dir_open(cfg.config_dir, 0, NULL);
+	if (dir == NULL) {
+		return;
+	}
+
+	while ((name = g_dir_read_name(dir))) {
+		if (!_ignored(name)) {
+			g_hash_table_add(changed, g_strdup(name));
+		}
+	}
+
+	g_dir_close(dir);
 }
 
-static void _layout_free(void *l_)
+/**
+ * Load a layout from wherever it lives. A layout in a broken cache comes out
+ * as the defaults.
+ */
+static struct layout* _layout_load(const struct layout_src *src)
 {
-	guint i;
-	struct layout *l = l_;
+	struct layout *l;
 
-	for (i = 0; i < G_N_ELEMENTS(l->combos); i++) {
-		g_ptr_array_free(l->combos[i], TRUE);
+	if (src->cache == NULL) {
+		return _layout_compile(_gen, src);
 	}
 
-	g_free(l);
+	l = _uncache_layout(_gen, src->cache, src->off);
+	if (l == NULL) {
+		g_critical("corrupt layout in config cache, using defaults");
+		l = _layout_new(_gen);
+		l->id = src->id;
+	}
+
+	return l;
 }
 
-static struct layout* _layout_new(void)
+static void _load_layouts(struct program *prog)
 {
 	guint i;
-	struct layout *l = g_malloc0(sizeof(*l));
 
-	for (i = 0; i < G_N_ELEMENTS(l->combos); i++) {
-		if (!keys_parse(keys_get_dev_default(i), &l->combos[i])) {
-			g_error("default layout parsing failed. this is a programmer bug.");
+	for (i = 0; i < prog->layouts_len; i++) {
+		if (prog->layouts[i] == NULL) {
+			prog->layouts[i] = _layout_load(prog->layout_srcs[i]);
 		}
 	}
-
-	return l;
 }
 
-static int _layout_cmp(const void *a_, const void *b_)
+/**
+ * Unloaded layouts go back to the generation to be reused; the arena only
+ * gives memory back when the whole generation goes.
+ */
+static void _unload_layouts(struct program *prog)
 {
-	const struct layout * const *a = a_;
-	const struct layout * const *b = b_;
-	return (*a)->id - (*b)->id;
+	guint i;
+
+	for (i = 0; i < prog->layouts_len; i++) {
+		g_ptr_array_add(_gen->spare, prog->layouts[i]);
+		prog->layouts[i] = NULL;
+	}
 }
 
-static void _program_free(void *prog_)
+/**
+ * Make sure a program's layouts are loaded, and note that it was used. The
+ * least recently used program beyond LRU_SIZE has its layouts dropped.
+ */
+static void _lru_use(struct program *prog)
 {
-	struct program *prog = prog_;
-	g_ptr_array_free(prog->cmds, TRUE);
-	g_ptr_array_free(prog->exes, TRUE);
-	g_ptr_array_free(prog->layouts, TRUE);
-	g_free(prog->name);
-	g_free(prog);
+	GList *link = g_queue_find(&_lru, prog);
+
+	if (link != NULL) {
+		g_queue_unlink(&_lru, link);
+		g_queue_push_head_link(&_lru, link);
+		return;
+	}
+
+	_load_layouts(prog);
+	g_queue_push_head(&_lru, prog);
+
+	if (g_queue_get_length(&_lru) > LRU_SIZE) {
+		_unload_layouts(g_queue_pop_tail(&_lru));
+	}
 }
 
-static int _program_cmp(const void *a_, const void *b_)
+static GHashTable* _changed_new(void)
 {
-	const struct program * const *a = a_;
-	const struct program * const *b = b_;
-	return g_strcmp0((*a)->name, (*b)->name);
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 }
 
-static void _parse_program(
-	struct program *prog G_GNUC_UNUSED,
-	GKeyFile *kf,
-	const char *group_name)
+/**
+ * Reload the changed files and build a generation from them
+ */
+static struct cfg_gen* _refresh(GHashTable *changed, gboolean rescan)
 {
-	size_t i;
-	char *val;
-	char **keys;
-	GPtrArray *ary;
-	size_t len = 0;
+	GHashTableIter iter;
+	gpointer name;
+	struct cfg_gen *gen;
+	gint64 start = g_get_monotonic_time();
+
+	_ensure_default(changed);
+	if (rescan) {
+		_mark_all(changed);
+	}
 
-	keys = g_key_file_get_keys(kf, group_name, &len, NULL);
-	for (i = 0; i < len; i++) {
-		ary = NULL;
-		if (g_str_has_prefix(keys[i], "cmd")) {
-			ary = prog->cmds;
-		} else if (g_str_has_prefix(keys[i], "exe")) {
-			ary = prog->exes;
-		}
+	TRACE2(config__refresh__start, g_hash_table_size(changed), rescan);
 
-		if (ary != NULL) {
-			val = g_key_file_get_string(kf, group_name, keys[i], NULL);
-			g_ptr_array_add(ary, g_strdup(val));
-		}
+	log_debug("config change detected, reloading %u file(s)...",
+		g_hash_table_size(changed));
+
+	g_hash_table_iter_init(&iter, changed);
+	while (g_hash_table_iter_next(&iter, &name, NULL)) {
+		_load(name);
 	}
 
-	g_strfreev(keys);
+	gen = _build_progs();
+	metrics_observe(&metrics.config_reload, g_get_monotonic_time() - start);
+	TRACE2(config__refresh__done, gen->programs->len, gen);
+
+	return gen;
 }
 
-static void _parse_layout(
-	struct program *prog,
-	GKeyFile *kf,
-	const char *group_name,
-	const char *main_group,
-	const char *layout_id)
+/**
+ * Swap a new generation in, moving the running program and layout over to
+ * it. This runs on the main loop, so nothing ever sees a config that's
+ * halfway there.
+ */
+static void _publish(struct cfg_gen *gen)
 {
-	guint i;
-	guint id;
-	char *val;
-	char *end;
-	struct layout *l;
+	int progi = -1;
+	struct program *prog;
+	struct cfg_gen *old = _gen;
 
-	id = g_ascii_strtoull(layout_id, &end, 10);
-	if (*end != '\0') {
-		g_critical("ignoring invalid layout id for %s: %s",
-			main_group,
-			layout_id);
-		return;
+	if (state.progi != -1) {
+		prog = g_ptr_array_index(cfg.programs, state.progi);
+		progi = _program_index(gen->programs, prog->name);
 	}
 
-	l = _layout_new();
-	l->id = id;
+	_gen = gen;
+	cfg.programs = gen->programs;
+	cfg.usb.backlight = gen->backlight;
+	cfg.usb.effects = gen->effects;
+
+	// Everything in there belongs to the old generation
+	g_queue_clear(&_lru);
+
+	if (progi != -1) {
+		prog = g_ptr_array_index(cfg.programs, progi);
+		_lru_use(prog);
+		state_set_prog(progi, state.prog_pid);
+		state_set_layout(MIN(state.layout, prog->layouts_len));
+	} else if (state.progi != -1) {
+		state_set_prog(-1, -1);
+		state_set_layout(0);
+	}
 
-	for (i = 0; i < G_N_ELEMENTS(l->combos); i++) {
-		val = g_key_file_get_string(
-			kf, group_name,
-			keys_get_dev_name(i), NULL);
-		if (val != NULL) {
-			GPtrArray *nl;
-			if (keys_parse(val, &nl)) {
-				g_ptr_array_free(l->combos[i], TRUE);
-				l->combos[i] = nl;
-			}
-		}
+	if (old != NULL) {
+		_gen_unref(old);
 	}
 
-	g_ptr_array_add(prog->layouts, l);
+	TRACE2(config__publish, gen->programs->len, gen);
+	cbs_config_updated();
 }
 
-static void _build_progs(GKeyFile *kf)
+static gpointer _worker(gpointer unused G_GNUC_UNUSED)
 {
-	size_t i;
-	size_t j;
-	char **parts;
-	char **groups;
-	size_t groupsc;
-	struct program *prog;
-
-	if (cfg.programs != NULL) {
-		g_ptr_array_free(cfg.programs, TRUE);
-	}
+	gboolean rescan;
+	GHashTable *changed;
+	struct cfg_gen *gen;
 
-	cfg.programs = g_ptr_array_new_with_free_func(_program_free);
+	while (TRUE) {
+		g_mutex_lock(&_lock);
 
-	groups = g_key_file_get_groups(kf, &groupsc);
-	for (i = 0; i < groupsc; i++) {
-		if (g_str_equal(groups[i], "default")) {
-			continue;
+		while (!_pending) {
+			g_cond_wait(&_wake, &_lock);
 		}
 
-		parts = g_strsplit(groups[i], ":", 0);
-		prog = NULL;
-		for (j = 0; j < cfg.programs->len; j++) {
-			struct program *p = g_ptr_array_index(cfg.programs, j);
-			if (g_str_equal(p->name, parts[0])) {
-				prog = p;
-				break;
-			}
-		}
+		_pending = FALSE;
+		changed = _changed;
+		_changed = _changed_new();
+		rescan = _rescan;
+		_rescan = FALSE;
 
-		if (prog == NULL) {
-			prog = g_malloc0(sizeof(*prog));
-			prog->name = g_strdup(parts[0]);
-			prog->cmds = g_ptr_array_new_with_free_func(g_free);
-			prog->exes = g_ptr_array_new_with_free_func(g_free);
-			prog->layouts = g_ptr_array_new_with_free_func(_layout_free);
-			g_ptr_array_add(cfg.programs, prog);
-		}
+		g_mutex_unlock(&_lock);
 
-		if (g_strv_length(parts) == 1) {
-			_parse_program(prog, kf, parts[0]);
-		} else {
-			_parse_layout(prog, kf, groups[i], parts[0], parts[1]);
+		gen = _refresh(changed, rescan);
+		g_hash_table_destroy(changed);
+
+		g_mutex_lock(&_lock);
+
+		// Superseded before the main loop got to it
+		if (_ready != NULL) {
+			_gen_unref(_ready);
 		}
 
-		g_strfreev(parts);
+		_ready = gen;
+
+		g_mutex_unlock(&_lock);
+
+		if (eventfd_write(_ready_fd, 1) == -1) {
+			g_critical("failed to wake main loop for config: %s",
+				strerror(errno));
+		}
 	}
 
-	g_strfreev(groups);
+	return NULL;
+}
 
-	g_ptr_array_sort(cfg.programs, _program_cmp);
-	for (i = 0; i < cfg.programs->len; i++) {
-		guint next_layout;
+static void _on_ready(int fd, void *nothing G_GNUC_UNUSED)
+{
+	eventfd_t val;
+	struct cfg_gen *gen;
 
-		prog = g_ptr_array_index(cfg.programs, i);
-		g_ptr_array_sort(prog->cmds, _strcmp);
-		g_ptr_array_sort(prog->exes, _strcmp);
-		g_ptr_array_sort(prog->layouts, _layout_cmp);
+	eventfd_read(fd, &val);
 
-		if (prog->layouts->len > 7) {
-			g_warning("found more than 7 layouts for %s; ignoring the extras",
-				prog->name);
-			g_ptr_array_set_size(prog->layouts, 7);
-		}
+	g_mutex_lock(&_lock);
+	gen = _ready;
+	_ready = NULL;
+	g_mutex_unlock(&_lock);
+
+	if (gen != NULL) {
+		_publish(gen);
+	}
+}
+
+static void _apply(void *nothing G_GNUC_UNUSED)
+{
+	_first_change = 0;
+	TRACE(config__apply);
 
-		for (next_layout = 1, j = 0; j < prog->layouts->len; j++, next_layout++) {
-			struct layout *l = g_ptr_array_index(prog->layouts, j);
+	g_mutex_lock(&_lock);
+	_pending = TRUE;
+	g_cond_signal(&_wake);
+	g_mutex_unlock(&_lock);
+}
 
-			if (l->id != next_layout) {
-				g_warning("for %s, missing layout #%d; "
-					"your layouts won't function as expected",
-					prog->name,
-					next_layout);
+static void _reload(int fd, void *nothing G_GNUC_UNUSED)
+{
+	ssize_t len;
+	const char *p;
+	const struct inotify_event *ev;
+	gboolean changed = FALSE;
+	gint64 now = g_get_monotonic_time() / 1000;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	g_mutex_lock(&_lock);
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event*)p;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				TRACE(config__overflow);
+				_rescan = TRUE;
+				changed = TRUE;
+			} else if (ev->len > 0 && !_ignored(ev->name)) {
+				TRACE2(config__change, (const char*)ev->name, ev->mask);
+				g_hash_table_add(_changed, g_strdup(ev->name));
+				changed = TRUE;
 			}
 		}
 	}
+
+	g_mutex_unlock(&_lock);
+
+	if (!changed) {
+		return;
+	}
+
+	if (_first_change == 0) {
+		_first_change = now;
+	}
+
+	if (now - _first_change < DEBOUNCE_MAX) {
+		poll_timer_arm(_debounce, DEBOUNCE);
+	}
 }
 
 static const char* _backlight_str(int backlight)
@@ -316,30 +1685,36 @@ static void _dump(void)
 
 	printf("config dir: %s\n", cfg.config_dir);
 	printf("backlight: %s\n", _backlight_str(cfg.usb.backlight));
+	printf("effects:%s%s%s%s\n",
+		cfg.usb.effects == 0 ? " none" : "",
+		cfg.usb.effects & effect_fade ? " fade" : "",
+		cfg.usb.effects & effect_flash ? " flash" : "",
+		cfg.usb.effects & effect_activity ? " activity" : "");
 	printf("\n");
 	printf("programs (%u):\n", cfg.programs->len);
 
 	for (i = 0; i < cfg.programs->len; i++) {
 		struct program *prog = g_ptr_array_index(cfg.programs, i);
 
-		printf(INDENT "%s (layouts: %u):\n", prog->name, prog->layouts->len);
+		_load_layouts(prog);
+
+		printf(INDENT "%s (layouts: %u):\n", prog->name, prog->layouts_len);
 
-		printf(INDENT INDENT "cmds (%u):\n", prog->cmds->len);
-		for (j = 0; j < prog->cmds->len; j++) {
-			char *s = g_ptr_array_index(prog->cmds, j);
-			printf(INDENT INDENT INDENT "%s\n", s);
+		printf(INDENT INDENT "cmds (%u):\n", g_strv_length(prog->cmds));
+		for (j = 0; prog->cmds[j] != NULL; j++) {
+			printf(INDENT INDENT INDENT "%s\n", prog->cmds[j]);
 		}
 
-		printf(INDENT INDENT "exes (%u):\n", prog->exes->len);
-		for (j = 0; j < prog->exes->len; j++) {
-			char *s = g_ptr_array_index(prog->exes, j);
+		printf(INDENT INDENT "exes (%u):\n", g_strv_length(prog->exes));
+		for (j = 0; prog->exes[j] != NULL; j++) {
+			char *s = prog->exes[j];
 			printf(INDENT INDENT INDENT "%s: %s\n",
 				*s == '/' ? "abs" : "rel",
 				s);
 		}
 
-		for (j = 0; j < prog->layouts->len; j++) {
-			struct layout *l = g_ptr_array_index(prog->layouts, j);
+		for (j = 0; j < prog->layouts_len; j++) {
+			struct layout *l = prog->layouts[j];
 
 			printf(INDENT INDENT "layout %u:\n", j + 1);
 
@@ -356,94 +1731,6 @@ static void _dump(void)
 	printf("\n");
 }
 
-static void _reload(int fd)
-{
-	int err;
-	GDir *dir;
-	GKeyFile *kf;
-	gboolean ok;
-	char *contents;
-	char ifdbuf[1024];
-	const char *path;
-	char *backlight;
-	GError *error = NULL;
-	GString *buff = g_string_new("");
-	GString *config = g_string_new("");
-
-	// Don't care about what happened, just that something did
-	while (read(fd, ifdbuf, sizeof(ifdbuf)) > 0);
-
-	g_debug("config change detected, reloading...");
-
-	if (!g_file_test(cfg.config_dir, G_FILE_TEST_IS_DIR)) {
-		err = g_mkdir_with_parents(cfg.config_dir, 0700);
-		if (err != 0) {
-			g_error("failed to create %s: %s",
-				cfg.config_dir,
-				strerror(errno));
-		}
-	}
-
-	g_string_printf(buff, "%s/%s", cfg.config_dir, "config.ini");
-	if (!g_file_test(buff->str, G_FILE_TEST_EXISTS)) {
-		ok = g_file_set_contents(buff->str, DEFAULT_CONFIG, -1, &error);
-		if (!ok) {
-			g_error("failed to create default config: %s", error->message);
-		}
-	}
-
-	dir = g_dir_open(cfg.config_dir, 0, NULL);
-	while ((path = g_dir_read_name(dir))) {
-		g_string_printf(buff, "%s/%s", cfg.config_dir, path);
-		ok = g_file_get_contents(buff->str, &contents, NULL, &error);
-
-		if (ok) {
-			g_string_append_c(config, '\n');
-			g_string_append(config, contents);
-			g_free(contents);
-		} else if (error->code != G_FILE_ERROR_NOENT) {
-			g_critical("failed to open config \"%s\": %s",
-				buff->str,
-				error->message);
-		}
-
-		g_clear_error(&error);
-	}
-
-	kf = g_key_file_new();
-	ok = g_key_file_load_from_data(kf, config->str, config->len, 0, &error);
-	if (!ok) {
-		g_critical("failed to parse config: %s", error->message);
-		g_clear_error(&error);
-	}
-
-	backlight = g_key_file_get_string(kf, "default", "backlight", NULL);
-	if (g_strcmp0(backlight, "off") == 0) {
-		cfg.usb.backlight = backlight_off;
-	} else if (g_strcmp0(backlight, "low") == 0) {
-		cfg.usb.backlight = backlight_low;
-	} else if (g_strcmp0(backlight, "med") == 0) {
-		cfg.usb.backlight = backlight_med;
-	} else if (g_strcmp0(backlight, "high") == 0) {
-		cfg.usb.backlight = backlight_high;
-	} else if (g_strcmp0(backlight, "pulse") == 0) {
-		cfg.usb.backlight = backlight_pulse;
-	} else {
-		cfg.usb.backlight = backlight_low;
-		g_critical("invalid backlight config, defaulting to low");
-	}
-
-	_build_progs(kf);
-
-	g_free(backlight);
-	g_dir_close(dir);
-	g_key_file_free(kf);
-	g_string_free(buff, TRUE);
-	g_string_free(config, TRUE);
-
-	cbs_config_updated();
-}
-
 void cfg_init(int argc, char **argv)
 {
 	int ifd;
@@ -452,15 +1739,20 @@ void cfg_init(int argc, char **argv)
 	struct option lopts[] = {
 		{ "authorize", optional_argument, NULL, 'a' },
 		{ "config-dir", required_argument, NULL, 'c' },
+		{ "control", optional_argument, NULL, '\2' },
 		{ "dump-config", no_argument, NULL, '\1' },
 		{ "help", no_argument, NULL, 'h' },
+		{ "metrics", optional_argument, NULL, 'm' },
+		{ "stall-budget", required_argument, NULL, 's' },
+		{ "status", optional_argument, NULL, '\3' },
+		{ "tap", optional_argument, NULL, '\4' },
 		{ NULL, 0, NULL, 0 },
 	};
 
 	memset(&cfg, 0, sizeof(cfg));
 
 	while (1) {
-		char c = getopt_long(argc, argv, "a::c:h", lopts, NULL);
+		char c = getopt_long(argc, argv, "a::c:hm::s:", lopts, NULL);
 		if (c == -1) {
 			break;
 		}
@@ -470,6 +1762,33 @@ void cfg_init(int argc, char **argv)
 				dump_cfg = TRUE;
 				break;
 
+			case '\2':
+				g_free(cfg.control_socket);
+				cfg.control_socket = optarg != NULL ?
+					g_strdup(optarg) :
+					g_build_filename(g_get_user_runtime_dir(),
+						"lintartarus.sock",
+						NULL);
+				break;
+
+			case '\3':
+				g_free(cfg.status_page);
+				cfg.status_page = optarg != NULL ?
+					g_strdup(optarg) :
+					g_build_filename(g_get_user_runtime_dir(),
+						"lintartarus-status",
+						NULL);
+				break;
+
+			case '\4':
+				g_free(cfg.tap);
+				cfg.tap = optarg != NULL ?
+					g_strdup(optarg) :
+					g_build_filename(g_get_user_runtime_dir(),
+						"lintartarus-tap",
+						NULL);
+				break;
+
 			case 'a':
 				udev_authorize(optarg);
 				break;
@@ -478,6 +1797,19 @@ void cfg_init(int argc, char **argv)
 				_set_config_dir(optarg);
 				break;
 
+			case 'm':
+				g_free(cfg.metrics_socket);
+				cfg.metrics_socket = optarg != NULL ?
+					g_strdup(optarg) :
+					g_build_filename(g_get_user_runtime_dir(),
+						"lintartarus-metrics.sock",
+						NULL);
+				break;
+
+			case 's':
+				poll_set_stall_budget(strtoul(optarg, NULL, 10));
+				break;
+
 			case 'h':
 			default:
 				_print_usage(argv);
@@ -488,6 +1820,18 @@ void cfg_init(int argc, char **argv)
 		_set_config_dir("~/.config/lintartarus");
 	}
 
+	_defaults_init();
+	_files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _file_unref);
+	_changed = _changed_new();
+	_debounce = poll_timer_new(_apply, NULL);
+
+	_ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_ready_fd == -1) {
+		g_error("failed to create config eventfd: %s", strerror(errno));
+	}
+
+	_ensure_default(_changed);
+
 	ifd = inotify_init1(IN_NONBLOCK);
 	if (ifd == -1) {
 		g_error("failed to create inotify instance: %s", strerror(errno));
@@ -495,16 +1839,49 @@ void cfg_init(int argc, char **argv)
 
 	err = inotify_add_watch(ifd,
 		cfg.config_dir,
-		IN_CLOSE_WRITE | IN_MOVED_TO);
+		IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
 	if (err == -1) {
 		g_error("failed to watch config directory: %s", strerror(errno));
 	}
 
-	poll_mod(ifd, _reload, TRUE, FALSE);
-	_reload(ifd);
+	poll_mod(ifd,
+		"config reload",
+		_reload,
+		NULL,
+		prio_housekeeping,
+		TRUE,
+		FALSE);
+	poll_mod(_ready_fd,
+		"config ready",
+		_on_ready,
+		NULL,
+		prio_housekeeping,
+		TRUE,
+		FALSE);
+
+	// The first load happens right here so that everything after starts out
+	// with a config. Changes after that are the worker's.
+	_publish(_refresh(_changed, TRUE));
+	g_hash_table_remove_all(_changed);
 
 	if (dump_cfg) {
 		_dump();
 		exit(0);
 	}
+
+	g_thread_unref(g_thread_new("config", _worker, NULL));
+}
+
+void cfg_reload()
+{
+	g_mutex_lock(&_lock);
+	_rescan = TRUE;
+	_pending = TRUE;
+	g_cond_signal(&_wake);
+	g_mutex_unlock(&_lock);
+}
+
+void cfg_on_prog_start()
+{
+	_lru_use(g_ptr_array_index(cfg.programs, state.progi));
 }
@@ -17,6 +17,7 @@
  */
 
 #pragma once
+#include "keys.h"
 #include "layout.h"
 #include "usb.h"
 
@@ -37,11 +38,16 @@ struct layout {
 	guint id;
 
 	/**
-	 * Kep mapping
+	 * Kep mapping. Combos are shared between layouts, so never modify them.
 	 */
-	GPtrArray *combos[15 + 4 + 2];
+	const struct combo *combos[15 + 4 + 2];
 };
 
+/**
+ * Where a layout comes from; internal to config
+ */
+struct layout_src;
+
 /**
  * A configured program, complete with layouts and everything!
  */
@@ -52,19 +58,27 @@ struct program {
 	char *name;
 
 	/**
-	 * A bunch of strings
+	 * A bunch of strings, NULL-terminated
 	 */
-	GPtrArray *cmds;
+	char **cmds;
+
+	/**
+	 * Even more strings, also NULL-terminated
+	 */
+	char **exes;
+
+	guint layouts_len;
 
 	/**
-	 * Even more strings
+	 * Where each layout comes from, sorted by layout ID
 	 */
-	GPtrArray *exes;
+	struct layout_src **layout_srcs;
 
 	/**
-	 * A bunch of layouts
+	 * A bunch of layouts, one per source. Entries are NULL until the layouts
+	 * are loaded, which only happens once the program runs.
 	 */
-	GPtrArray *layouts;
+	struct layout **layouts;
 };
 
 /**
@@ -73,10 +87,35 @@ struct program {
 struct config {
 	char *config_dir;
 
+	/**
+	 * Where to serve metrics; NULL if nowhere
+	 */
+	char *metrics_socket;
+
+	/**
+	 * Where to serve the control socket; NULL if nowhere
+	 */
+	char *control_socket;
+
+	/**
+	 * Where to publish the status page; NULL if nowhere
+	 */
+	char *status_page;
+
+	/**
+	 * Where to publish the event tap; NULL if nowhere
+	 */
+	char *tap;
+
 	GPtrArray *programs;
 
 	struct {
 		enum usb_backlight backlight;
+
+		/**
+		 * Bitmask of enum effect
+		 */
+		guint effects;
 	} usb;
 };
 
@@ -89,3 +128,13 @@ struct config cfg;
  * Setup global config
  */
 void cfg_init(int argc, char **argv);
+
+/**
+ * A program started: load its layouts
+ */
+void cfg_on_prog_start(void);
+
+/**
+ * Reload everything now, without waiting for things to settle
+ */
+void cfg_reload(void);
@@ -0,0 +1,290 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <glib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "callbacks.h"
+#include "config.h"
+#include "control.h"
+#include "poll.h"
+#include "proc.h"
+#include "state.h"
+
+/**
+ * Most connections to have open at once; any more are turned away
+ */
+#define MAX_CLIENTS 16
+
+/**
+ * Biggest message either way, names included
+ */
+#define MSG_MAX 512
+
+struct _client {
+	int fd;
+	gboolean subscribed;
+
+	/**
+	 * Fell behind while its own request was being handled
+	 */
+	gboolean hung_up;
+};
+
+static GPtrArray *_clients;
+
+/**
+ * Whose request is being handled, so that it's not freed out from under
+ * the handler
+ */
+static struct _client *_serving;
+
+static void _client_close(struct _client *c)
+{
+	poll_rm(c->fd);
+	close(c->fd);
+	g_ptr_array_remove_fast(_clients, c);
+	g_free(c);
+}
+
+/**
+ * Send the state to a client. Never waits: a client that isn't keeping up
+ * with what it asked for is hung up on.
+ */
+static void _send(
+	struct _client *c,
+	enum control_op op,
+	enum control_status status)
+{
+	gsize len = 0;
+	ssize_t sent;
+	union {
+		struct control_reply r;
+		char buf[MSG_MAX];
+	} msg;
+
+	memset(&msg.r, 0, sizeof(msg.r));
+	msg.r.op = op;
+	msg.r.status = status;
+	msg.r.forced = proc_forced();
+	msg.r.progi = state.progi;
+	msg.r.pid = state.prog_pid;
+	msg.r.layout = state.layout;
+
+	if (state.progi != -1) {
+		struct program *prog = g_ptr_array_index(cfg.programs, state.progi);
+
+		msg.r.layouts = prog->layouts_len;
+		len = MIN(strlen(prog->name), sizeof(msg) - sizeof(msg.r));
+		memcpy(msg.r.name, prog->name, len);
+	}
+
+	sent = send(c->fd, &msg, sizeof(msg.r) + len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent == -1) {
+		if (c == _serving) {
+			c->hung_up = TRUE;
+		} else {
+			_client_close(c);
+		}
+	}
+}
+
+static enum control_status _set_layout(guint32 layout)
+{
+	struct program *prog;
+
+	if (state.progi == -1) {
+		return control_no_prog;
+	}
+
+	prog = g_ptr_array_index(cfg.programs, state.progi);
+	if (layout == 0 || layout > prog->layouts_len) {
+		return control_no_layout;
+	}
+
+	state_set_layout(layout);
+	cbs_check_state();
+
+	return control_ok;
+}
+
+static enum control_status _set_prog(const char *name, gsize len)
+{
+	guint i;
+	struct program *prog;
+
+	if (len == 0) {
+		proc_force(-1);
+		return control_ok;
+	}
+
+	for (i = 0; i < cfg.programs->len; i++) {
+		prog = g_ptr_array_index(cfg.programs, i);
+		if (strlen(prog->name) == len && memcmp(prog->name, name, len) == 0) {
+			proc_force(i);
+			return control_ok;
+		}
+	}
+
+	return control_unknown_prog;
+}
+
+static void _client(int fd, void *c_)
+{
+	ssize_t len;
+	struct _client *c = c_;
+	enum control_status status = control_ok;
+	union {
+		struct control_req r;
+		char buf[MSG_MAX];
+	} msg;
+
+	len = recv(fd, &msg, sizeof(msg), MSG_DONTWAIT);
+	if (len == -1 && errno == EAGAIN) {
+		return;
+	}
+
+	if (len <= 0) {
+		_client_close(c);
+		return;
+	}
+
+	if ((gsize)len < sizeof(msg.r)) {
+		msg.r.op = 0;
+		status = control_bad_request;
+		len = sizeof(msg.r);
+	}
+
+	_serving = c;
+
+	switch (msg.r.op) {
+		case control_get:
+			break;
+
+		case control_set_layout:
+			status = _set_layout(msg.r.layout);
+			break;
+
+		case control_set_prog:
+			status = _set_prog(msg.r.name, len - sizeof(msg.r));
+			break;
+
+		case control_reload:
+			cfg_reload();
+			break;
+
+		case control_subscribe:
+			c->subscribed = TRUE;
+			break;
+
+		default:
+			status = control_bad_request;
+			break;
+	}
+
+	_send(c, msg.r.op, status);
+
+	_serving = NULL;
+	if (c->hung_up) {
+		_client_close(c);
+	}
+}
+
+static void _accept(int fd, void *nothing G_GNUC_UNUSED)
+{
+	int cfd;
+	struct _client *c;
+
+	while ((cfd = accept(fd, NULL, NULL)) != -1) {
+		if (_clients->len >= MAX_CLIENTS) {
+			close(cfd);
+			continue;
+		}
+
+		c = g_malloc0(sizeof(*c));
+		c->fd = cfd;
+		g_ptr_array_add(_clients, c);
+
+		poll_mod(cfd, "control client", _client, c, prio_output, TRUE, FALSE);
+	}
+}
+
+void control_init(const char *path)
+{
+	int fd;
+	int err;
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		g_error("control socket path too long: %s", path);
+	}
+
+	strcpy(addr.sun_path, path);
+	_clients = g_ptr_array_new();
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		g_error("failed to create control socket: %s", strerror(errno));
+	}
+
+	// Left over from a previous run
+	unlink(path);
+
+	err = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+	if (err == -1) {
+		g_error("failed to bind control socket %s: %s", path, strerror(errno));
+	}
+
+	// Anyone who can connect can switch programs around
+	err = chmod(path, S_IRUSR | S_IWUSR);
+	if (err == -1) {
+		g_error("failed to set control socket permissions: %s",
+			strerror(errno));
+	}
+
+	err = listen(fd, MAX_CLIENTS);
+	if (err == -1) {
+		g_error("failed to listen on control socket: %s", strerror(errno));
+	}
+
+	poll_mod(fd, "control", _accept, NULL, prio_output, TRUE, FALSE);
+}
+
+void control_on_state_changed(void)
+{
+	guint i;
+	struct _client *c;
+
+	if (_clients == NULL) {
+		return;
+	}
+
+	// Backwards, since clients that fall behind are removed
+	for (i = _clients->len; i > 0; i--) {
+		c = g_ptr_array_index(_clients, i - 1);
+		if (c->subscribed) {
+			_send(c, control_push, control_ok);
+		}
+	}
+}
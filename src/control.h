@@ -0,0 +1,127 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+
+/*
+ * The control socket speaks in SOCK_SEQPACKET messages: each request is one
+ * struct control_req, and each gets back exactly one struct control_reply
+ * with the state as it is after the request. Subscribers also get a reply
+ * with op control_push whenever the state changes. Everything is in host
+ * byte order.
+ */
+
+enum control_op {
+	/**
+	 * Just get the state
+	 */
+	control_get = 1,
+
+	/**
+	 * Switch the running program to layout `layout`
+	 */
+	control_set_layout,
+
+	/**
+	 * Run as if program `name` were running until told otherwise. With an
+	 * empty name, go back to looking for programs.
+	 */
+	control_set_prog,
+
+	/**
+	 * Reload config now, skipping the wait for more changes. The reply comes
+	 * right away; the new config comes with a push.
+	 */
+	control_reload,
+
+	/**
+	 * Get a push whenever the state changes, for as long as the connection
+	 * is open
+	 */
+	control_subscribe,
+
+	/**
+	 * Never sent by clients: the state changed
+	 */
+	control_push,
+};
+
+enum control_status {
+	control_ok,
+	control_bad_request,
+	control_no_prog,
+	control_no_layout,
+	control_unknown_prog,
+};
+
+struct control_req {
+	guint8 op;
+	guint8 pad[3];
+	guint32 layout;
+
+	/**
+	 * To the end of the message, not NUL-terminated
+	 */
+	char name[];
+};
+
+struct control_reply {
+	/**
+	 * The request answered, or control_push
+	 */
+	guint8 op;
+
+	guint8 status;
+
+	/**
+	 * If the program was set with control_set_prog
+	 */
+	guint8 forced;
+
+	guint8 pad;
+
+	/**
+	 * Running program's index in the config and its pid (0 when forced), or
+	 * -1 for both if none
+	 */
+	gint32 progi;
+	gint32 pid;
+
+	guint32 layout;
+
+	/**
+	 * How many layouts the running program has
+	 */
+	guint32 layouts;
+
+	/**
+	 * Running program's name, to the end of the message
+	 */
+	char name[];
+};
+
+/**
+ * Serve the control socket at `path`
+ */
+void control_init(const char *path);
+
+/**
+ * Push the state to subscribers
+ */
+void control_on_state_changed(void);
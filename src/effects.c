@@ -0,0 +1,251 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "config.h"
+#include "const.h"
+#include "effects.h"
+#include "poll.h"
+#include "state.h"
+#include "usb.h"
+
+/**
+ * Shortest time between frames, in ms: never more than ~30 per second
+ */
+#define FRAME_MIN 33
+
+/**
+ * Effects get at most 1/FRAME_DUTY of the control endpoint's time
+ */
+#define FRAME_DUTY 2
+
+/**
+ * Each frame is a single command: written, then read back
+ */
+#define FRAME_TRANSFERS 2
+
+/**
+ * How long each effect runs, in ms
+ */
+#define FADE_LEN 400
+#define FLASH_LEN 300
+#define ACTIVITY_LEN 150
+
+/**
+ * How much brighter a key press makes the backlight
+ */
+#define ACTIVITY_BUMP 64
+
+/**
+ * Start time of an effect that's not running. The poll clock may well start
+ * at 0, so that can't be it.
+ */
+#define STOPPED G_MININT64
+
+static struct poll_timer *_timer;
+
+/**
+ * If the frame timer is running
+ */
+static gboolean _ticking;
+
+/**
+ * Level the backlight settles at when no effects are running
+ */
+static guint8 _rest;
+
+/**
+ * Last level handed to the device
+ */
+static guint8 _sent;
+
+/**
+ * Layout last seen, to notice layout changes
+ */
+static guint _layout;
+
+/**
+ * When each effect started on the poll clock, or STOPPED if it's not running
+ */
+static gint64 _fade_start = STOPPED;
+static gint64 _flash_start = STOPPED;
+static gint64 _activity_start = STOPPED;
+
+/**
+ * Where the running fade started from
+ */
+static guint8 _fade_from;
+
+static gboolean _enabled(enum effect effect)
+{
+	// Pulsing is done by the device; don't fight it
+	if (cfg.usb.backlight == backlight_pulse) {
+		return FALSE;
+	}
+
+	return (cfg.usb.effects & effect) != 0;
+}
+
+static guint8 _rest_level(void)
+{
+	if (state.progi == -1 || cfg.usb.backlight == backlight_pulse) {
+		return light_levels[backlight_off].a;
+	}
+
+	return light_levels[cfg.usb.backlight].a;
+}
+
+/**
+ * How much of an effect is left, from 1 (just started) down to 0 (done)
+ */
+static gdouble _remaining(gint64 *start, guint len, gint64 now)
+{
+	gint64 elapsed;
+
+	if (*start == STOPPED) {
+		return 0;
+	}
+
+	elapsed = now - *start;
+	if (elapsed >= len * 1000) {
+		*start = STOPPED;
+		return 0;
+	}
+
+	return 1.0 - (gdouble)elapsed / (len * 1000);
+}
+
+/**
+ * Figure out the level for the current moment. Returns if any effects are
+ * still running.
+ */
+static gboolean _level(gint64 now, guint8 *level)
+{
+	gdouble rem;
+	gdouble l = _rest;
+
+	rem = _remaining(&_fade_start, FADE_LEN, now);
+	l += (_fade_from - l) * rem;
+
+	rem = _remaining(&_flash_start, FLASH_LEN, now);
+	l += (0xff - l) * rem;
+
+	rem = _remaining(&_activity_start, ACTIVITY_LEN, now);
+	l = MIN(0xff, l + ACTIVITY_BUMP * rem);
+
+	*level = (guint8)(l + 0.5);
+
+	return _fade_start != STOPPED ||
+		_flash_start != STOPPED ||
+		_activity_start != STOPPED;
+}
+
+/**
+ * Frames are spaced so that the control endpoint is busy with them for at
+ * most 1/FRAME_DUTY of the time, based on how long transfers actually take.
+ */
+static guint _frame_interval(void)
+{
+	guint cost = usb_get_transfer_cost() * FRAME_TRANSFERS * FRAME_DUTY;
+	return MAX(FRAME_MIN, cost / 1000);
+}
+
+static void _tick(void *nothing G_GNUC_UNUSED)
+{
+	guint8 level;
+	gboolean running = _level(poll_now(), &level);
+	gboolean sent = TRUE;
+
+	// usb.c comes back to effects_get_level() for the level to send
+	if (level != _sent) {
+		sent = usb_sync_level();
+	}
+
+	// If the device was busy, the final frame still has to go out
+	_ticking = running || !sent;
+	if (_ticking) {
+		poll_timer_arm(_timer, _frame_interval());
+	}
+}
+
+static void _start(void)
+{
+	if (!_ticking) {
+		_ticking = TRUE;
+		poll_timer_arm(_timer, 0);
+	}
+}
+
+void effects_init(void)
+{
+	_timer = poll_timer_new(_tick, NULL);
+	_rest = _rest_level();
+	_sent = _rest;
+}
+
+guint8 effects_get_level(void)
+{
+	_level(poll_now(), &_sent);
+	return _sent;
+}
+
+void effects_on_state_changed(void)
+{
+	guint8 level;
+	guint8 rest = _rest_level();
+	gint64 now = poll_now();
+
+	if (rest != _rest) {
+		if (_enabled(effect_fade)) {
+			_level(now, &level);
+			_fade_from = level;
+			_fade_start = now;
+		} else {
+			_fade_start = STOPPED;
+		}
+
+		_rest = rest;
+	}
+
+	if (state.layout != _layout) {
+		if (_layout != 0 && state.layout != 0 && _enabled(effect_flash)) {
+			_flash_start = now;
+		}
+
+		_layout = state.layout;
+	}
+
+	if (state.progi == -1) {
+		_flash_start = STOPPED;
+		_activity_start = STOPPED;
+	}
+
+	if (_fade_start != STOPPED || _flash_start != STOPPED) {
+		_start();
+	}
+}
+
+void effects_on_key_press(void)
+{
+	if (state.progi == -1 || !_enabled(effect_activity)) {
+		return;
+	}
+
+	_activity_start = poll_now();
+	_start();
+}
@@ -0,0 +1,49 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+
+/**
+ * Lighting effects that can be enabled in the config
+ */
+enum effect {
+	effect_fade = 1 << 0,
+	effect_flash = 1 << 1,
+	effect_activity = 1 << 2,
+};
+
+/**
+ * Get effects ready to run
+ */
+void effects_init(void);
+
+/**
+ * Get the backlight level the device should be showing right now
+ */
+guint8 effects_get_level(void);
+
+/**
+ * State changed. Start any effects that go along with it.
+ */
+void effects_on_state_changed(void);
+
+/**
+ * A mapped key was pressed
+ */
+void effects_on_key_press(void);
@@ -0,0 +1,119 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <linux/input.h>
+#include <unistd.h>
+#include "callbacks.h"
+#include "input.h"
+#include "keys.h"
+#include "layout.h"
+#include "log.h"
+#include "metrics.h"
+#include "tap.h"
+#include "trace.h"
+#include "uinput.h"
+
+static void _handle_code(int code, int value)
+{
+	if (code < 0) {
+		layout_handle_internal(code);
+	} else {
+		uinput_send(code, value);
+	}
+}
+
+void input_read(int fd, void *nothing G_GNUC_UNUSED)
+{
+	int key;
+	gint64 when;
+	guint i;
+	guint j;
+	ssize_t err;
+	const gint16 *step;
+	struct input_event ev;
+	const struct combo *combo;
+
+	err = read(fd, &ev, sizeof(ev));
+	if (err != sizeof(ev)) {
+		if (err != -1) {
+			g_critical("did not get complete input event: "
+				"%" G_GSSIZE_FORMAT " != %" G_GSSIZE_FORMAT,
+				err,
+				sizeof(ev));
+		}
+
+		return;
+	}
+
+	// Event times are on the monotonic clock; see uinput.c
+	when = (gint64)ev.input_event_sec * G_USEC_PER_SEC + ev.input_event_usec;
+	TRACE4(input__read, ev.type, ev.code, ev.value, when);
+
+	if (ev.type != EV_KEY) {
+		return;
+	}
+
+	key = layout_key(ev.code);
+	combo = key == -1 ? NULL : layout_translate(key);
+	tap_write(when, key, ev.code, ev.value, combo);
+
+	if (key == -1) {
+		return;
+	}
+
+	if (ev.value == 1) {
+		metrics_add(&metrics.key_presses[key], 1);
+	}
+
+	if (combo == NULL) {
+		return;
+	}
+
+	log_debug("got combo");
+
+	if (ev.value == 1) {
+		cbs_key_press();
+	}
+
+	/*
+	 * If there's only 1 combo, fire it in step with the key press from the
+	 * device. If there's more than 1, fire the combo and ignore keyup.
+	 */
+	step = combo->codes;
+	if (combo->steps == 1) {
+		for (i = 1; i <= (guint)*step; i++) {
+			_handle_code(step[i], ev.value);
+		}
+	} else if (ev.value == 1) {
+		for (i = 0; i < combo->steps; i++, step += *step + 1) {
+			// Send key down
+			for (j = 1; j <= (guint)*step; j++) {
+				_handle_code(step[j], 1);
+			}
+
+			// Send key up
+			for (j = 1; j <= (guint)*step; j++) {
+				_handle_code(step[j], 0);
+			}
+		}
+	}
+
+	metrics_observe(&metrics.translate, g_get_monotonic_time() - when);
+	TRACE2(input__done, key, when);
+}
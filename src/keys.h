@@ -17,6 +17,7 @@
  */
 
 #pragma once
+#include <glib.h>
 
 /**
  * Key code for changing to next layout
@@ -29,8 +30,43 @@
 #define KEY_PREV_LAYOUT -1
 
 /**
- * Get the corresponding keycode for the given key name, or -1 if it doesn't
- * exist.
+ * A parsed key combo, laid out flat so that it can be shared and live in an
+ * arena or a mapped cache
+ */
+struct combo {
+	/**
+	 * Number of steps, each pressed and released before the next
+	 */
+	guint16 steps;
+
+	/**
+	 * Number of entries in codes
+	 */
+	guint16 len;
+
+	/**
+	 * For each step: how many keys are in it, followed by their codes. Every
+	 * key code fits in 16 bits, internal ones included.
+	 */
+	gint16 codes[];
+};
+
+/**
+ * Most 16-bit words a combo may take, header included
+ */
+#define KEYS_COMBO_MAX 128
+
+/**
+ * Room to parse a combo into
+ */
+union combo_buf {
+	struct combo combo;
+	guint16 raw[KEYS_COMBO_MAX];
+};
+
+/**
+ * Get the corresponding keycode for the given key name, or 0 (KEY_RESERVED)
+ * if it doesn't exist.
  */
 int keys_code(const char *name);
 
@@ -51,13 +87,27 @@ const char* keys_get_dev_default(const guint i);
 
 /**
  * Parse a human-readable sequence of keys into a machine-usable sequence.
+ * Steps are separated by whitespace, and keys within a step by "+".
+ *
+ * The combo is built in `buf`, without allocating anything.
+ */
+gboolean keys_parse(const char *keys, union combo_buf *buf);
+
+/**
+ * Size of a combo, in bytes
+ */
+gsize keys_combo_size(const struct combo *combo);
+
+/**
+ * Hash of a combo. Only depends on what's in it, so it's the same across
+ * reloads and runs.
  */
-gboolean keys_parse(const char *keys, GPtrArray **combo);
+guint keys_combo_hash(const struct combo *combo);
 
 /**
  * Dump a human-reasable key sequence
  */
-char* keys_dump(GPtrArray *combo);
+char* keys_dump(const struct combo *combo);
 
 /**
  * Get all known key codes.
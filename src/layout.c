@@ -21,6 +21,7 @@
 #include "layout.h"
 #include "keys.h"
 #include "state.h"
+#include "trace.h"
 
 /**
  * Keycodes for input values, living at their index in layout.keys
@@ -36,33 +37,34 @@ void layout_init()
 	}
 }
 
-const GPtrArray* layout_translate(int code)
+int layout_key(int code)
 {
 	guint i;
-	gboolean found;
-	struct layout *layout;
-	struct program *program;
 
-	if (state.layout == 0) {
-		return NULL;
-	}
-
-	found = FALSE;
 	for (i = 0; i < G_N_ELEMENTS(_mapping); i++) {
 		if (_mapping[i] == code) {
-			found = TRUE;
-			break;
+			return i;
 		}
 	}
 
-	if (!found) {
-		return NULL;
+	return -1;
+}
+
+const struct combo* layout_translate(guint key)
+{
+	struct layout *layout;
+	struct program *program;
+	const struct combo *combo = NULL;
+
+	if (state.layout != 0) {
+		program = g_ptr_array_index(cfg.programs, state.progi);
+		layout = program->layouts[state.layout - 1];
+		combo = layout->combos[key];
 	}
 
-	program = g_ptr_array_index(cfg.programs, state.progi);
-	layout = g_ptr_array_index(program->layouts, state.layout - 1);
+	TRACE3(layout__translate, key, state.layout, combo);
 
-	return layout->combos[i];
+	return combo;
 }
 
 void layout_handle_internal(int code)
@@ -72,7 +74,7 @@ void layout_handle_internal(int code)
 
 	switch (code) {
 		case KEY_NEXT_LAYOUT:
-			if (layout == program->layouts->len) {
+			if (layout == program->layouts_len) {
 				layout = 1;
 			} else {
 				layout++;
@@ -81,7 +83,7 @@ void layout_handle_internal(int code)
 
 		case KEY_PREV_LAYOUT:
 			if (layout == 1) {
-				layout = program->layouts->len;
+				layout = program->layouts_len;
 			} else {
 				layout--;
 			}
@@ -102,7 +104,7 @@ void layout_on_config_updated()
 
 	program = g_ptr_array_index(cfg.programs, state.progi);
 
-	state_set_layout(MIN(state.layout, program->layouts->len));
+	state_set_layout(MIN(state.layout, program->layouts_len));
 }
 
 void layout_on_prog_start()
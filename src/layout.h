@@ -18,6 +18,7 @@
 
 #pragma once
 #include <glib.h>
+#include "keys.h"
 
 /**
  * Basic layout init
@@ -25,9 +26,14 @@
 void layout_init(void);
 
 /**
- * Trigger the event corresponding to the given code
+ * Which key on the device a code comes from, or -1 if it isn't one of them
  */
-const GPtrArray* layout_translate(int code);
+int layout_key(int code);
+
+/**
+ * Trigger the event corresponding to the given key, from layout_key()
+ */
+const struct combo* layout_translate(guint key);
 
 /**
  * Handle an internal command for the layout
@@ -17,15 +17,25 @@
  */
 
 #include "config.h"
+#include "control.h"
+#include "effects.h"
+#include "log.h"
+#include "metrics.h"
 #include "poll.h"
 #include "uinput.h"
 #include "state.h"
+#include "status.h"
+#include "tap.h"
 // #include "usb.h"
 
 int main(int argc, char **argv)
 {
 	state_init();
+
+	// Blocks SIGUSR1, so it has to come before anything starts a thread
 	poll_init();
+	log_init();
+	effects_init();
 
 	layout_init();
 
@@ -33,6 +43,23 @@ int main(int argc, char **argv)
 
 	uinput_init();
 	usb_init();
+
+	if (cfg.metrics_socket != NULL) {
+		metrics_init(cfg.metrics_socket);
+	}
+
+	if (cfg.control_socket != NULL) {
+		control_init(cfg.control_socket);
+	}
+
+	if (cfg.status_page != NULL) {
+		status_init(cfg.status_page);
+	}
+
+	if (cfg.tap != NULL) {
+		tap_init(cfg.tap);
+	}
+
 	poll_run();
 
 	return 1;
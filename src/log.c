@@ -0,0 +1,253 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "log.h"
+
+/**
+ * Records in the ring; must be a power of 2
+ */
+#define RECS 256
+
+/**
+ * Size of a record, message included. Longer messages are cut short.
+ */
+#define REC_SIZE 256
+
+#define DOMAIN_LEN 24
+
+struct _rec_head {
+	/**
+	 * Which lap of the ring the record is on. Equal to the record's position
+	 * when it's free for that position, and one past it once it's written.
+	 */
+	guint seq;
+
+	GLogLevelFlags level;
+	gint64 time;
+	char domain[DOMAIN_LEN];
+};
+
+struct _rec {
+	struct _rec_head h;
+	char msg[REC_SIZE - sizeof(struct _rec_head)];
+};
+
+static struct _rec _ring[RECS];
+
+/**
+ * Next position to write, shared by every thread that logs
+ */
+static guint _tail;
+
+/**
+ * Next position to read; only touched with _lock held
+ */
+static guint _head;
+
+/**
+ * Messages that didn't fit
+ */
+static guint _dropped;
+
+/**
+ * Set while the writer is waiting for something to write
+ */
+static gint _waiting;
+
+static gboolean _verbose;
+
+/**
+ * Held by whoever is writing records out
+ */
+static GMutex _lock;
+static GCond _wake;
+
+static const char* _level_str(GLogLevelFlags level)
+{
+	switch (level & G_LOG_LEVEL_MASK) {
+		case G_LOG_LEVEL_ERROR:    return "ERROR";
+		case G_LOG_LEVEL_CRITICAL: return "CRITICAL";
+		case G_LOG_LEVEL_WARNING:  return "WARNING";
+		case G_LOG_LEVEL_MESSAGE:  return "Message";
+		case G_LOG_LEVEL_INFO:     return "INFO";
+		default:                   return "DEBUG";
+	}
+}
+
+static void _write(const struct _rec *rec)
+{
+	struct tm tm;
+	time_t secs = rec->h.time / G_USEC_PER_SEC;
+
+	localtime_r(&secs, &tm);
+
+	fprintf(stderr, "%02d:%02d:%02d.%03d %s%s%s: %s\n",
+		tm.tm_hour,
+		tm.tm_min,
+		tm.tm_sec,
+		(int)(rec->h.time % G_USEC_PER_SEC / 1000),
+		rec->h.domain,
+		rec->h.domain[0] == '\0' ? "" : "-",
+		_level_str(rec->h.level),
+		rec->msg);
+}
+
+/**
+ * Write out everything in the ring. Must hold _lock.
+ */
+static void _drain(void)
+{
+	guint dropped;
+	struct _rec *rec;
+
+	while (TRUE) {
+		rec = _ring + (_head & (RECS - 1));
+		if (__atomic_load_n(&rec->h.seq, __ATOMIC_SEQ_CST) != _head + 1) {
+			break;
+		}
+
+		_write(rec);
+		__atomic_store_n(&rec->h.seq, _head + RECS, __ATOMIC_RELEASE);
+		_head++;
+	}
+
+	dropped = __atomic_exchange_n(&_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped > 0) {
+		fprintf(stderr, "%u log message(s) dropped\n", dropped);
+	}
+
+	fflush(stderr);
+}
+
+static gpointer _writer(gpointer unused G_GNUC_UNUSED)
+{
+	// On Linux, this only applies to the calling thread
+	setpriority(PRIO_PROCESS, 0, 19);
+
+	g_mutex_lock(&_lock);
+
+	while (TRUE) {
+		_drain();
+
+		// Anything logged after this is set wakes the writer, and anything
+		// before is seen by the check below
+		__atomic_store_n(&_waiting, 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&_ring[_head & (RECS - 1)].h.seq,
+				__ATOMIC_SEQ_CST) != _head + 1) {
+			g_cond_wait(&_wake, &_lock);
+		}
+
+		__atomic_store_n(&_waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static gboolean _push(
+	const char *domain,
+	GLogLevelFlags level,
+	const char *msg)
+{
+	guint seq;
+	struct _rec *rec;
+	guint pos = __atomic_load_n(&_tail, __ATOMIC_RELAXED);
+
+	while (TRUE) {
+		rec = _ring + (pos & (RECS - 1));
+		seq = __atomic_load_n(&rec->h.seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&_tail, &pos, pos + 1,
+					FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if ((gint)(seq - pos) < 0) {
+			// Still holding a record from the last lap: full
+			return FALSE;
+		} else {
+			pos = __atomic_load_n(&_tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	rec->h.level = level;
+	rec->h.time = g_get_real_time();
+	g_strlcpy(rec->h.domain, domain == NULL ? "" : domain, DOMAIN_LEN);
+	g_strlcpy(rec->msg, msg, sizeof(rec->msg));
+
+	__atomic_store_n(&rec->h.seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	return TRUE;
+}
+
+static void _handler(
+	const char *domain,
+	GLogLevelFlags level,
+	const char *msg,
+	gpointer unused G_GNUC_UNUSED)
+{
+	// Same as glib's default
+	if ((level & (G_LOG_LEVEL_DEBUG | G_LOG_LEVEL_INFO)) && !_verbose) {
+		return;
+	}
+
+	if (level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR)) {
+		log_flush();
+		g_log_default_handler(domain, level, msg, NULL);
+		return;
+	}
+
+	if (!_push(domain, level, msg)) {
+		__atomic_add_fetch(&_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (__atomic_load_n(&_waiting, __ATOMIC_SEQ_CST)) {
+		g_mutex_lock(&_lock);
+		g_cond_signal(&_wake);
+		g_mutex_unlock(&_lock);
+	}
+}
+
+void log_init(void)
+{
+	guint i;
+
+	for (i = 0; i < RECS; i++) {
+		_ring[i].h.seq = i;
+	}
+
+	_verbose = g_strcmp0(g_getenv("G_MESSAGES_DEBUG"), "all") == 0;
+
+	g_thread_unref(g_thread_new("log", _writer, NULL));
+	g_log_set_default_handler(_handler, NULL);
+	atexit(log_flush);
+}
+
+void log_flush(void)
+{
+	g_mutex_lock(&_lock);
+	_drain();
+	g_mutex_unlock(&_lock);
+}
@@ -0,0 +1,44 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+
+/**
+ * Debug logging only exists in builds made with DEBUG set (`make DEBUG=1`);
+ * everywhere else, calls are checked and then compiled out entirely.
+ */
+#ifdef DEBUG
+#	define log_debug(...) g_debug(__VA_ARGS__)
+#else
+#	define log_debug(...) do { if (0) { g_debug(__VA_ARGS__); } } while (0)
+#endif
+
+/**
+ * Take over glib's logging: messages are copied into a ring buffer and
+ * written out later by a low-priority thread, so logging never waits on
+ * stderr. Fatal messages still go out immediately, along with everything
+ * before them. Call it after poll_init(), so the writer thread doesn't get
+ * SIGUSR1.
+ */
+void log_init(void);
+
+/**
+ * Write out everything logged so far
+ */
+void log_flush(void);
@@ -0,0 +1,323 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "config.h"
+#include "keys.h"
+#include "log.h"
+#include "metrics.h"
+#include "poll.h"
+#include "state.h"
+
+/**
+ * Most scrapes to have going at once; any more are turned away
+ */
+#define MAX_CLIENTS 8
+
+/**
+ * How long a client has to send an HTTP request before it's given the plain
+ * text format, in ms
+ */
+#define REQUEST_WAIT_MS 100
+
+struct _client {
+	int fd;
+	struct poll_timer *timer;
+};
+
+static guint _clients;
+
+static void _counter(
+	GString *s,
+	const char *name,
+	const char *help,
+	guint64 val)
+{
+	g_string_append_printf(s,
+		"# HELP %s %s\n"
+		"# TYPE %s counter\n"
+		"%s %" G_GUINT64_FORMAT "\n",
+		name, help,
+		name,
+		name, val);
+}
+
+static void _hist(
+	GString *s,
+	const char *name,
+	const char *help,
+	const struct metrics_hist *h)
+{
+	guint i;
+	guint64 count = 0;
+
+	g_string_append_printf(s,
+		"# HELP %s %s\n"
+		"# TYPE %s histogram\n",
+		name, help,
+		name);
+
+	for (i = 0; i < METRICS_BUCKETS - 1; i++) {
+		count += metrics_get(&h->buckets[i]);
+		g_string_append_printf(s,
+			"%s_bucket{le=\"%.9g\"} %" G_GUINT64_FORMAT "\n",
+			name,
+			(1 << i) / (gdouble)G_USEC_PER_SEC,
+			count);
+	}
+
+	// Read last so that +Inf is never short of the buckets before it
+	count = MAX(count, metrics_get(&h->count));
+
+	g_string_append_printf(s,
+		"%s_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n"
+		"%s_sum %.9g\n"
+		"%s_count %" G_GUINT64_FORMAT "\n",
+		name, count,
+		name, metrics_get(&h->sum) / (gdouble)G_USEC_PER_SEC,
+		name, count);
+}
+
+static void _label(GString *s, const char *val)
+{
+	for (; *val != '\0'; val++) {
+		switch (*val) {
+			case '\\': g_string_append(s, "\\\\"); break;
+			case '"':  g_string_append(s, "\\\""); break;
+			case '\n': g_string_append(s, "\\n"); break;
+			default:   g_string_append_c(s, *val); break;
+		}
+	}
+}
+
+static GString* _collect(void)
+{
+	guint i;
+	GString *s = g_string_new("");
+
+	g_string_append(s,
+		"# HELP lintartarus_key_presses_total "
+			"Presses of each key on the Tartarus\n"
+		"# TYPE lintartarus_key_presses_total counter\n");
+
+	for (i = 0; i < METRICS_KEYS; i++) {
+		g_string_append_printf(s,
+			"lintartarus_key_presses_total{key=\"%s\"} %" G_GUINT64_FORMAT "\n",
+			keys_get_dev_name(i),
+			metrics_get(&metrics.key_presses[i]));
+	}
+
+	_hist(s, "lintartarus_translate_seconds",
+		"Time from the kernel seeing a key to its mapping being sent",
+		&metrics.translate);
+	_counter(s, "lintartarus_usb_syncs_total",
+		"Syncs of lighting state to the device",
+		metrics_get(&metrics.usb_syncs));
+	_counter(s, "lintartarus_usb_failures_total",
+		"Syncs that failed",
+		metrics_get(&metrics.usb_failures));
+	_hist(s, "lintartarus_usb_sync_seconds",
+		"Time taken by syncs that completed",
+		&metrics.usb_sync);
+	_counter(s, "lintartarus_proc_pids_total",
+		"Processes looked at while scanning for configured programs",
+		metrics_get(&metrics.proc_pids));
+	_hist(s, "lintartarus_proc_scan_seconds",
+		"Time taken by each scan for configured programs",
+		&metrics.proc_scan);
+	_hist(s, "lintartarus_config_reload_seconds",
+		"Time taken to load config changes",
+		&metrics.config_reload);
+
+	g_string_append_printf(s,
+		"# HELP lintartarus_layout Layout in use, 0 if none\n"
+		"# TYPE lintartarus_layout gauge\n"
+		"lintartarus_layout %u\n"
+		"# HELP lintartarus_program Program that's running\n"
+		"# TYPE lintartarus_program gauge\n",
+		state.layout);
+
+	if (state.progi != -1) {
+		struct program *prog = g_ptr_array_index(cfg.programs, state.progi);
+
+		g_string_append(s, "lintartarus_program{name=\"");
+		_label(s, prog->name);
+		g_string_append_printf(s, "\",pid=\"%d\"} 1\n", state.prog_pid);
+	}
+
+	return s;
+}
+
+static void _client_close(struct _client *c)
+{
+	poll_rm(c->fd);
+	poll_timer_free(c->timer);
+	close(c->fd);
+	g_free(c);
+	_clients--;
+}
+
+/**
+ * Answer and be done with a client. Anything that asked over HTTP gets an
+ * HTTP response, so curl --unix-socket works.
+ */
+static void _respond(struct _client *c, gboolean http)
+{
+	ssize_t sent;
+	GString *s = NULL;
+	GString *body = _collect();
+
+	if (http) {
+		s = g_string_new("");
+		g_string_printf(s,
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %" G_GSIZE_FORMAT "\r\n"
+			"\r\n",
+			body->len);
+		g_string_append_len(s, body->str, body->len);
+		g_string_free(body, TRUE);
+		body = s;
+	}
+
+	// Never waits on the client: a scrape that doesn't fit is dropped
+	sent = send(c->fd, body->str, body->len, MSG_NOSIGNAL);
+	if (sent == -1 && (errno == EPIPE || errno == ECONNRESET)) {
+		log_debug("metrics client left before its answer");
+	} else if (sent != (ssize_t)body->len) {
+		g_warning("failed to send metrics: %s",
+			sent == -1 ? strerror(errno) : "short write");
+	}
+
+	g_string_free(body, TRUE);
+	_client_close(c);
+}
+
+/**
+ * A client said something (or hung up)
+ */
+static void _client(int fd, void *c_)
+{
+	char req[256];
+	struct _client *c = c_;
+	ssize_t len = read(fd, req, sizeof(req));
+
+	if (len == -1) {
+		if (errno != EAGAIN) {
+			_client_close(c);
+		}
+
+		return;
+	}
+
+	// Hung up without waiting for an answer, as health checks do
+	if (len == 0) {
+		_client_close(c);
+		return;
+	}
+
+	_respond(c, len >= 4 && memcmp(req, "GET ", 4) == 0);
+}
+
+/**
+ * A client connected and didn't ask for anything: connecting is enough
+ */
+static void _client_waited(void *c)
+{
+	_respond(c, FALSE);
+}
+
+static void _accept(int fd, void *nothing G_GNUC_UNUSED)
+{
+	int cfd;
+	struct _client *c;
+
+	while ((cfd = accept(fd, NULL, NULL)) != -1) {
+		if (_clients >= MAX_CLIENTS ||
+			fcntl(cfd, F_SETFL, O_NONBLOCK) == -1) {
+			g_warning("turning away metrics client: %s",
+				_clients >= MAX_CLIENTS ?
+					"too many clients" : strerror(errno));
+			close(cfd);
+			continue;
+		}
+
+		c = g_malloc0(sizeof(*c));
+		c->fd = cfd;
+		c->timer = poll_timer_new(_client_waited, c);
+
+		_clients++;
+		poll_mod(cfd,
+			"metrics client",
+			_client,
+			c,
+			prio_housekeeping,
+			TRUE,
+			FALSE);
+		poll_timer_arm(c->timer, REQUEST_WAIT_MS);
+	}
+}
+
+void metrics_init(const char *path)
+{
+	int fd;
+	int err;
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		g_error("metrics socket path too long: %s", path);
+	}
+
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		g_error("failed to create metrics socket: %s", strerror(errno));
+	}
+
+	// Left over from a previous run
+	unlink(path);
+
+	err = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+	if (err == -1) {
+		g_error("failed to bind metrics socket %s: %s", path, strerror(errno));
+	}
+
+	// Program names and pids aren't for everyone
+	err = chmod(path, S_IRUSR | S_IWUSR);
+	if (err == -1) {
+		g_error("failed to set metrics socket permissions: %s",
+			strerror(errno));
+	}
+
+	err = listen(fd, MAX_CLIENTS);
+	if (err == -1) {
+		g_error("failed to listen on metrics socket: %s", strerror(errno));
+	}
+
+	poll_mod(fd, "metrics", _accept, NULL, prio_housekeeping, TRUE, FALSE);
+}
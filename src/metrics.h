@@ -0,0 +1,95 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+#include "config.h"
+
+/**
+ * Keys on the device
+ */
+#define METRICS_KEYS G_N_ELEMENTS(((struct layout*)NULL)->combos)
+
+/**
+ * Buckets in a histogram: bucket i counts observations of at most 2^i us,
+ * and the last one everything longer
+ */
+#define METRICS_BUCKETS 22
+
+struct metrics_hist {
+	guint64 count;
+
+	/**
+	 * In us
+	 */
+	guint64 sum;
+
+	guint64 buckets[METRICS_BUCKETS];
+};
+
+/**
+ * Counters served on the metrics socket. Every counter has a single thread
+ * writing to it, so only go through the functions below, which keep reads
+ * from tearing without ever taking a lock.
+ */
+struct metrics {
+	guint64 key_presses[METRICS_KEYS];
+
+	/**
+	 * From the kernel seeing a key to everything it's mapped to being sent
+	 */
+	struct metrics_hist translate;
+
+	guint64 usb_syncs;
+	guint64 usb_failures;
+	struct metrics_hist usb_sync;
+
+	guint64 proc_pids;
+	struct metrics_hist proc_scan;
+
+	struct metrics_hist config_reload;
+};
+
+/**
+ * Global counters
+ */
+struct metrics metrics;
+
+static inline guint64 metrics_get(const guint64 *c)
+{
+	return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_add(guint64 *c, guint64 n)
+{
+	__atomic_store_n(c, metrics_get(c) + n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_observe(struct metrics_hist *h, gint64 us)
+{
+	guint bucket = us <= 1 ? 0 : g_bit_storage(us - 1);
+
+	metrics_add(&h->count, 1);
+	metrics_add(&h->sum, MAX(us, 0));
+	metrics_add(&h->buckets[MIN(bucket, METRICS_BUCKETS - 1)], 1);
+}
+
+/**
+ * Serve metrics on a UNIX socket at `path`
+ */
+void metrics_init(const char *path);
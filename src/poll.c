@@ -18,30 +18,261 @@
 
 #include <errno.h>
 #include <glib.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 #include "callbacks.h"
+#include "log.h"
 #include "poll.h"
 
+/**
+ * Most events to take from epoll at once. The batch starts small and grows
+ * whenever it fills up.
+ */
+#define BATCH_MIN 16
+#define BATCH_MAX 256
+
+/**
+ * How long a round may take, in us, before housekeeping waits for the next
+ */
+#define ROUND_BUDGET 2000
+
+/**
+ * Longest housekeeping can be put off, in us
+ */
+#define ROUND_DEFER_MAX G_USEC_PER_SEC
+
+/**
+ * Default for how long, in ms, any one handler may run before it's logged
+ */
+#define STALL_BUDGET 50
+
+/**
+ * Handlers are allocated this many at a time and never move, so epoll can
+ * point straight at them
+ */
+#define HANDLERS_CHUNK 32
+
+struct _handler {
+	int fd;
+	const char *name;
+
+	/**
+	 * NULL once removed
+	 */
+	poll_cb cb;
+
+	void *data;
+	enum poll_prio prio;
+	struct poll_stats stats;
+
+	/**
+	 * Next free or retired handler
+	 */
+	struct _handler *next;
+};
+
+/*
+ * Timers live in a hierarchical wheel of 1ms ticks: the root holds the next
+ * 256 ticks, one slot each, and every level above it covers 64 times as much
+ * as the one below. Each time the root wraps, the next slot up is spread
+ * back down, so arming and cancelling are O(1) no matter how many timers are
+ * pending, and one timerfd wakes the loop for whatever's due first.
+ */
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_ROOT_SLOTS (1 << WHEEL_ROOT_BITS)
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 3
+
+/**
+ * Each slot in a level above the root covers 1 << WHEEL_SHIFT(level) ticks
+ */
+#define WHEEL_SHIFT(level) (WHEEL_ROOT_BITS + (level) * WHEEL_BITS)
+
+/**
+ * Farthest out a timer can be placed, a bit more than 18 hours. Anything
+ * later waits at the top and is placed again when it comes around.
+ */
+#define WHEEL_MAX ((G_GINT64_CONSTANT(1) << WHEEL_SHIFT(WHEEL_LEVELS)) - 1)
+
+struct poll_timer {
+	/**
+	 * Next timer in the same slot
+	 */
+	struct poll_timer *next;
+
+	/**
+	 * Whatever points to this timer, or NULL when it isn't armed
+	 */
+	struct poll_timer **prev;
+
+	/**
+	 * Tick to fire on
+	 */
+	gint64 due;
+
+	poll_timer_cb cb;
+	void *data;
+};
+
+static struct {
+	int fd;
+
+	/**
+	 * Next tick to run
+	 */
+	gint64 tick;
+
+	/**
+	 * Tick the timerfd is set for, G_MAXINT64 when it isn't
+	 */
+	gint64 armed;
+
+	/**
+	 * Number of armed timers
+	 */
+	guint pending;
+
+	/**
+	 * Set while timers fire, so that rearming waits until they're done
+	 */
+	gboolean running;
+
+	struct poll_timer *root[WHEEL_ROOT_SLOTS];
+	struct poll_timer *levels[WHEEL_LEVELS][WHEEL_SLOTS];
+} _wheel;
+
+static gint64 (*_clock)(void) = g_get_monotonic_time;
+
 static int _epoll;
-static GHashTable *_cbs;
+
+/**
+ * Registered handlers, indexed by fd
+ */
+static GPtrArray *_handlers;
+
+/**
+ * Handlers ready to be reused
+ */
+static struct _handler *_free;
+
+/**
+ * Handlers removed during the current round: a later event in the batch
+ * might still point at them, so they can't be reused until it's over
+ */
+static struct _handler *_retired;
+
+/**
+ * How long each round took, from epoll_wait() returning to going back to it
+ */
+static struct poll_stats _rounds;
+
+/**
+ * How long each poll tick took
+ */
+static struct poll_stats _ticks;
+
+/**
+ * How late timers fired
+ */
+static struct poll_stats _lag;
+
+/**
+ * In us; 0 to never log stalls
+ */
+static gint64 _stall_budget = STALL_BUDGET * 1000;
+
+static void _timer_fired(int fd, void *nothing);
+static void _report(int fd, void *nothing);
 
 void poll_init()
 {
-	_cbs = g_hash_table_new(NULL, NULL);
+	int fd;
+	sigset_t mask;
+
+	_handlers = g_ptr_array_new();
 	_epoll = epoll_create1(0);
 	if (_epoll == -1) {
 		g_error("failed to init epoll: %s", strerror(errno));
 	}
+
+	_wheel.armed = G_MAXINT64;
+	_wheel.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (_wheel.fd == -1) {
+		g_error("failed to create timer: %s", strerror(errno));
+	}
+
+	poll_mod(_wheel.fd, "timers", _timer_fired, NULL, prio_output, TRUE, FALSE);
+
+	// Blocked before any threads start, so that they all leave it alone
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+		g_error("failed to block SIGUSR1");
+	}
+
+	fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd == -1) {
+		g_error("failed to create signalfd: %s", strerror(errno));
+	}
+
+	poll_mod(fd, "report", _report, NULL, prio_housekeeping, TRUE, FALSE);
+}
+
+static struct _handler* _handler_get(int fd)
+{
+	if (fd < 0 || (guint)fd >= _handlers->len) {
+		return NULL;
+	}
+
+	return g_ptr_array_index(_handlers, fd);
 }
 
-void poll_mod(int fd, poll_cb cb, gboolean read, gboolean write)
+static struct _handler* _handler_new(int fd)
+{
+	guint i;
+	struct _handler *h;
+
+	if (_free == NULL) {
+		h = g_new0(struct _handler, HANDLERS_CHUNK);
+		for (i = 0; i < HANDLERS_CHUNK; i++) {
+			h[i].next = _free;
+			_free = h + i;
+		}
+	}
+
+	h = _free;
+	_free = h->next;
+	memset(h, 0, sizeof(*h));
+	h->fd = fd;
+
+	if ((guint)fd >= _handlers->len) {
+		g_ptr_array_set_size(_handlers, fd + 1);
+	}
+
+	g_ptr_array_index(_handlers, fd) = h;
+
+	return h;
+}
+
+void poll_mod(
+	int fd,
+	const char *name,
+	poll_cb cb,
+	void *data,
+	enum poll_prio prio,
+	gboolean read,
+	gboolean write)
 {
 	int err;
+	struct _handler *h = _handler_get(fd);
 	struct epoll_event ev = {
 		.events = 0,
-		.data.fd = fd,
 	};
 
 	if (read) {
@@ -52,12 +283,17 @@ void poll_mod(int fd, poll_cb cb, gboolean read, gboolean write)
 		ev.events |= EPOLLOUT;
 	}
 
-	if (!g_hash_table_contains(_cbs, GINT_TO_POINTER(fd))) {
+	if (h == NULL) {
+		h = _handler_new(fd);
+		ev.data.ptr = h;
+
 		err = epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
 		if (err == -1) {
 			g_error("failed to add to epoll: %s", strerror(errno));
 		}
 	} else {
+		ev.data.ptr = h;
+
 		err = epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev);
 		if (err == -1) {
 			g_error("failed to mod event: %s", strerror(errno));
@@ -65,36 +301,481 @@ void poll_mod(int fd, poll_cb cb, gboolean read, gboolean write)
 	}
 
 	// Allow cb to be changed
-	g_hash_table_insert(_cbs, GINT_TO_POINTER(fd), cb);
+	h->name = name;
+	h->cb = cb;
+	h->data = data;
+	h->prio = prio;
 }
 
 void poll_rm(int fd)
 {
-	g_hash_table_remove(_cbs, GINT_TO_POINTER(fd));
+	struct _handler *h = _handler_get(fd);
+
+	if (h == NULL) {
+		return;
+	}
+
 	epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, NULL);
+	g_ptr_array_index(_handlers, fd) = NULL;
+
+	h->cb = NULL;
+	h->next = _retired;
+	_retired = h;
 }
 
-void poll_run()
+const struct poll_stats* poll_get_stats(int fd)
+{
+	struct _handler *h = _handler_get(fd);
+
+	return h == NULL ? NULL : &h->stats;
+}
+
+static void _stats_add(struct poll_stats *s, gint64 t)
+{
+	s->calls++;
+	s->time += t;
+	s->max = MAX(s->max, t);
+	s->hist[MIN(t <= 0 ? 0 : g_bit_storage(t), POLL_HIST_BUCKETS - 1)]++;
+}
+
+/**
+ * Log anything that held up the loop for too long
+ */
+static void _watchdog(const char *name, gint64 t)
+{
+	if (_stall_budget > 0 && t > _stall_budget) {
+		g_warning("%s stalled the main loop for %.1fms (budget is %.1fms)",
+			name,
+			t / 1000.0,
+			_stall_budget / 1000.0);
+	}
+}
+
+/**
+ * Run a handler, returning when it finished
+ */
+static gint64 _dispatch(struct _handler *h, gint64 now)
+{
+	gint64 end;
+
+	// Might have been removed by something earlier in the batch
+	if (h->cb == NULL) {
+		return now;
+	}
+
+	h->cb(h->fd, h->data);
+
+	end = g_get_monotonic_time();
+	_stats_add(&h->stats, end - now);
+	_watchdog(h->name, end - now);
+
+	return end;
+}
+
+/**
+ * Roughly where the given fraction of calls finished by, in us
+ */
+static gint64 _percentile(const struct poll_stats *s, gdouble q)
+{
+	guint i;
+	guint64 seen = 0;
+
+	for (i = 0; i < POLL_HIST_BUCKETS - 1; i++) {
+		seen += s->hist[i];
+		if (seen >= s->calls * q) {
+			break;
+		}
+	}
+
+	return MIN(G_GINT64_CONSTANT(1) << i, s->max);
+}
+
+static void _report_line(
+	const char *name,
+	const char *prio,
+	const struct poll_stats *s)
+{
+	g_message("%-12s %-12s %10" G_GUINT64_FORMAT " %10.1f %8.1f"
+		" %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT,
+		name,
+		prio,
+		s->calls,
+		s->time / 1000.0,
+		s->calls == 0 ? 0.0 : (gdouble)s->time / s->calls,
+		_percentile(s, 0.5),
+		_percentile(s, 0.99),
+		s->max);
+}
+
+static void _report(int fd, void *nothing G_GNUC_UNUSED)
+{
+	guint i;
+	struct signalfd_siginfo si;
+	const char *prios[] = {
+		"input",
+		"output",
+		"usb",
+		"housekeeping",
+	};
+
+	while (read(fd, &si, sizeof(si)) == sizeof(si));
+
+	g_message("%-12s %-12s %10s %10s %8s %8s %8s %8s",
+		"handler", "priority", "calls", "total ms",
+		"avg us", "p50 us", "p99 us", "max us");
+
+	for (i = 0; i < _handlers->len; i++) {
+		struct _handler *h = g_ptr_array_index(_handlers, i);
+
+		if (h != NULL) {
+			_report_line(h->name, prios[h->prio], &h->stats);
+		}
+	}
+
+	_report_line("poll tick", "housekeeping", &_ticks);
+	_report_line("rounds", "-", &_rounds);
+	_report_line("timer lag", "-", &_lag);
+}
+
+void poll_set_stall_budget(guint ms)
+{
+	_stall_budget = (gint64)ms * 1000;
+}
+
+/**
+ * Handle a batch, highest priority first. Once the round is over budget,
+ * housekeeping gets one handler and the rest stay ready for next time.
+ */
+static gboolean _round(struct epoll_event *evs, int n, gint64 start)
 {
 	int i;
-	int fd;
-	int err;
-	poll_cb cb;
-	struct epoll_event evs[8];
+	guint prio;
+	struct _handler *h;
+	gint64 now = start;
+	gboolean deferred = FALSE;
+	gboolean housekept = FALSE;
+
+	for (prio = prio_input; prio <= prio_housekeeping; prio++) {
+		for (i = 0; i < n; i++) {
+			h = evs[i].data.ptr;
+			if (h->prio != prio) {
+				continue;
+			}
+
+			if (prio == prio_housekeeping) {
+				if (housekept && now - start > ROUND_BUDGET) {
+					deferred = TRUE;
+					continue;
+				}
 
-	g_debug("poll running...");
+				housekept = TRUE;
+			}
+
+			now = _dispatch(h, now);
+		}
+	}
+
+	while ((h = _retired) != NULL) {
+		_retired = h->next;
+		h->next = _free;
+		_free = h;
+	}
+
+	_stats_add(&_rounds, now - start);
+
+	return !deferred && now - start <= ROUND_BUDGET;
+}
+
+void poll_run()
+{
+	int n;
+	gint64 start;
+	gint64 last_tick = 0;
+	int batch = BATCH_MIN;
+	struct epoll_event evs[BATCH_MAX];
+
+	log_debug("poll running...");
 
 	while (TRUE) {
-		err = epoll_wait(_epoll, evs, G_N_ELEMENTS(evs), 1000);
+		n = epoll_wait(_epoll, evs, batch, 1000);
+		start = g_get_monotonic_time();
+
+		if (n == batch) {
+			batch = MIN(batch * 2, BATCH_MAX);
+		} else if (n < batch / 4) {
+			batch = MAX(batch / 2, BATCH_MIN);
+		}
+
+		if (_round(evs, MAX(n, 0), start) ||
+			start - last_tick >= ROUND_DEFER_MAX) {
+			last_tick = g_get_monotonic_time();
+			cbs_poll_tick();
+
+			start = g_get_monotonic_time();
+			_stats_add(&_ticks, start - last_tick);
+			_watchdog("poll tick", start - last_tick);
+		}
+	}
+}
+
+static void _unlink(struct poll_timer *t)
+{
+	*t->prev = t->next;
+	if (t->next != NULL) {
+		t->next->prev = t->prev;
+	}
+
+	t->next = NULL;
+	t->prev = NULL;
+}
+
+static void _link(struct poll_timer **head, struct poll_timer *t)
+{
+	t->next = *head;
+	t->prev = head;
+	if (*head != NULL) {
+		(*head)->prev = &t->next;
+	}
+
+	*head = t;
+}
+
+/**
+ * Put a timer in the slot it belongs in, given the current tick
+ */
+static void _place(struct poll_timer *t)
+{
+	guint level;
+	gint64 due = t->due;
+	gint64 delta = due - _wheel.tick;
+
+	if (delta < WHEEL_ROOT_SLOTS) {
+		// Anything overdue runs with the next tick
+		_link(&_wheel.root[MAX(due, _wheel.tick) & (WHEEL_ROOT_SLOTS - 1)], t);
+		return;
+	}
+
+	if (delta > WHEEL_MAX) {
+		due = _wheel.tick + WHEEL_MAX;
+		delta = WHEEL_MAX;
+	}
+
+	for (level = 0; delta >> WHEEL_SHIFT(level + 1) != 0; level++);
+
+	_link(&_wheel.levels[level][(due >> WHEEL_SHIFT(level)) & (WHEEL_SLOTS - 1)],
+		t);
+}
+
+/**
+ * Take everything out of a slot, leaving it headed by `list`
+ */
+static void _detach(struct poll_timer **slot, struct poll_timer **list)
+{
+	*list = *slot;
+	*slot = NULL;
+
+	if (*list != NULL) {
+		(*list)->prev = list;
+	}
+}
+
+/**
+ * Spread a slot out over the levels below it
+ */
+static void _cascade(guint level, guint slot)
+{
+	struct poll_timer *t;
+	struct poll_timer *list;
+
+	_detach(&_wheel.levels[level][slot], &list);
+
+	while ((t = list) != NULL) {
+		_unlink(t);
+		_place(t);
+	}
+}
+
+/**
+ * The next tick anything has to happen on: either a timer firing or a slot
+ * being spread out
+ */
+static gint64 _next(void)
+{
+	guint i;
+	guint level;
+	gint64 next = G_MAXINT64;
+
+	if (_wheel.pending == 0) {
+		return next;
+	}
+
+	for (i = 0; i < WHEEL_ROOT_SLOTS; i++) {
+		if (_wheel.root[(_wheel.tick + i) & (WHEEL_ROOT_SLOTS - 1)] != NULL) {
+			next = _wheel.tick + i;
+			break;
+		}
+	}
 
-		for (i = 0; i < err; i++) {
-			fd = evs[i].data.fd;
-			cb = g_hash_table_lookup(_cbs, GINT_TO_POINTER(fd));
-			if (cb != NULL) {
-				cb(fd);
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		guint shift = WHEEL_SHIFT(level);
+		gint64 at = ((_wheel.tick - 1) >> shift) + 1;
+
+		for (i = 0; i < WHEEL_SLOTS && (at << shift) < next; i++, at++) {
+			if (_wheel.levels[level][at & (WHEEL_SLOTS - 1)] != NULL) {
+				next = at << shift;
+				break;
 			}
 		}
+	}
 
-		cbs_poll_tick();
+	return next;
+}
+
+/**
+ * Point the timerfd at whatever's next
+ */
+static void _rearm(gint64 next)
+{
+	int err;
+	gint64 wait;
+	struct itimerspec its;
+
+	if (next == _wheel.armed) {
+		return;
 	}
+
+	memset(&its, 0, sizeof(its));
+
+	// Even when something's overdue: a zero timeout would disarm the timerfd
+	if (next != G_MAXINT64) {
+		wait = MAX(next * 1000 - _clock(), 0);
+		its.it_value.tv_sec = wait / G_USEC_PER_SEC;
+		its.it_value.tv_nsec = (wait % G_USEC_PER_SEC) * 1000 + 1;
+	}
+
+	err = timerfd_settime(_wheel.fd, 0, &its, NULL);
+	if (err == -1) {
+		g_critical("failed to set timer: %s", strerror(errno));
+		return;
+	}
+
+	_wheel.armed = next;
+}
+
+void poll_timers_run(void)
+{
+	guint i;
+	guint level;
+	struct poll_timer *t;
+	struct poll_timer *list;
+	gint64 us = _clock();
+	gint64 now = us / 1000;
+
+	_wheel.running = TRUE;
+
+	while (_wheel.tick <= now) {
+		if (_wheel.pending == 0) {
+			_wheel.tick = now + 1;
+			break;
+		}
+
+		i = _wheel.tick & (WHEEL_ROOT_SLOTS - 1);
+		for (level = 0; i == 0 && level < WHEEL_LEVELS; level++) {
+			guint slot = (_wheel.tick >> WHEEL_SHIFT(level)) & (WHEEL_SLOTS - 1);
+
+			_cascade(level, slot);
+			if (slot != 0) {
+				break;
+			}
+		}
+
+		// Nothing for this tick: skip ahead to the next one that has something
+		if (_wheel.root[i] == NULL) {
+			_wheel.tick = MAX(_wheel.tick + 1, MIN(_next(), now + 1));
+			continue;
+		}
+
+		_detach(&_wheel.root[i], &list);
+		_wheel.tick++;
+
+		// Callbacks are free to arm and cancel anything, these included
+		while ((t = list) != NULL) {
+			_unlink(t);
+			_wheel.pending--;
+			_stats_add(&_lag, us - t->due * 1000);
+			t->cb(t->data);
+		}
+	}
+
+	_wheel.running = FALSE;
+	_rearm(_next());
+}
+
+static void _timer_fired(int fd, void *nothing G_GNUC_UNUSED)
+{
+	guint64 expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) <= 0) {
+		return;
+	}
+
+	// One-shot: it's not set for anything anymore
+	_wheel.armed = G_MAXINT64;
+	poll_timers_run();
+}
+
+struct poll_timer* poll_timer_new(poll_timer_cb cb, void *data)
+{
+	struct poll_timer *t = g_malloc0(sizeof(*t));
+
+	t->cb = cb;
+	t->data = data;
+
+	return t;
+}
+
+void poll_timer_free(struct poll_timer *t)
+{
+	poll_timer_cancel(t);
+	g_free(t);
+}
+
+void poll_timer_arm(struct poll_timer *t, guint ms)
+{
+	gint64 now = _clock();
+
+	poll_timer_cancel(t);
+
+	// Nothing depends on where the wheel is when it's empty, so catch it up
+	if (_wheel.pending == 0 && !_wheel.running) {
+		_wheel.tick = now / 1000;
+	}
+
+	// Round up: never fire early
+	t->due = (now + (gint64)ms * 1000 + 999) / 1000;
+
+	_place(t);
+	_wheel.pending++;
+
+	if (!_wheel.running && t->due < _wheel.armed) {
+		_rearm(t->due);
+	}
+}
+
+void poll_timer_cancel(struct poll_timer *t)
+{
+	if (t->prev != NULL) {
+		_unlink(t);
+		_wheel.pending--;
+	}
+}
+
+void poll_set_clock(gint64 (*now)(void))
+{
+	_clock = now;
+}
+
+gint64 poll_now(void)
+{
+	return _clock();
 }
@@ -18,7 +18,69 @@
 
 #pragma once
 
-typedef void (*poll_cb)(int fd);
+typedef void (*poll_cb)(int fd, void *data);
+
+/**
+ * What an fd is for. Whenever several are ready at once, they're handled in
+ * this order.
+ */
+enum poll_prio {
+	/**
+	 * Key presses from the Tartarus: someone's waiting on these
+	 */
+	prio_input,
+
+	/**
+	 * Timers: lighting frames, retries and debounces
+	 */
+	prio_output,
+
+	/**
+	 * Transfers to and from the device
+	 */
+	prio_usb,
+
+	/**
+	 * Config reloads and device scans. These can wait for a later round when
+	 * a round has already run long.
+	 */
+	prio_housekeeping,
+};
+
+/**
+ * Buckets in a poll_stats histogram
+ */
+#define POLL_HIST_BUCKETS 24
+
+/**
+ * What a handler has cost so far
+ */
+struct poll_stats {
+	guint64 calls;
+
+	/**
+	 * Total time spent in the callback, in us
+	 */
+	gint64 time;
+
+	/**
+	 * Longest single call, in us
+	 */
+	gint64 max;
+
+	/**
+	 * Calls by how long they took: bucket i counts those under 2^i us, and
+	 * the last one everything longer
+	 */
+	guint64 hist[POLL_HIST_BUCKETS];
+};
+
+/**
+ * A one-shot timer, fired from the main loop
+ */
+struct poll_timer;
+
+typedef void (*poll_timer_cb)(void *data);
 
 /**
  * Initialize polling
@@ -26,9 +88,17 @@ typedef void (*poll_cb)(int fd);
 void poll_init(void);
 
 /**
- * Add a callback
+ * Add a callback, or change the one for an fd. `data` is passed along to it,
+ * and `name` is what it's called in reports and stall warnings.
  */
-void poll_mod(int fd, poll_cb cb, gboolean read, gboolean write);
+void poll_mod(
+	int fd,
+	const char *name,
+	poll_cb cb,
+	void *data,
+	enum poll_prio prio,
+	gboolean read,
+	gboolean write);
 
 /**
  * Remove an FD
@@ -36,6 +106,54 @@ void poll_mod(int fd, poll_cb cb, gboolean read, gboolean write);
 void poll_rm(int fd);
 
 /**
- * Run the main loop
+ * How an fd's handler has been doing, or NULL if it isn't registered
+ */
+const struct poll_stats* poll_get_stats(int fd);
+
+/**
+ * Run the main loop. Sending SIGUSR1 logs how long every handler has been
+ * taking.
  */
 void poll_run(void);
+
+/**
+ * Log any handler that runs for longer than this. 0 turns it off.
+ */
+void poll_set_stall_budget(guint ms);
+
+/**
+ * Create a timer. It doesn't fire until armed.
+ */
+struct poll_timer* poll_timer_new(poll_timer_cb cb, void *data);
+
+/**
+ * Cancel and free a timer
+ */
+void poll_timer_free(struct poll_timer *t);
+
+/**
+ * Fire the timer once, `ms` from now, replacing any pending expiration
+ */
+void poll_timer_arm(struct poll_timer *t, guint ms);
+
+/**
+ * Stop a pending timer from firing
+ */
+void poll_timer_cancel(struct poll_timer *t);
+
+/**
+ * Fire every timer that's due. The main loop does this itself; it's only
+ * needed when driving timers by hand with poll_set_clock().
+ */
+void poll_timers_run(void);
+
+/**
+ * Clock for timers to run on, in us. Defaults to g_get_monotonic_time(). Only
+ * change it while no timers are armed.
+ */
+void poll_set_clock(gint64 (*now)(void));
+
+/**
+ * Current time on the clock timers run on, in us
+ */
+gint64 poll_now(void);
@@ -21,18 +21,26 @@
 #include <string.h>
 #include "callbacks.h"
 #include "config.h"
+#include "log.h"
+#include "metrics.h"
 #include "proc.h"
 #include "state.h"
+#include "trace.h"
+
+/**
+ * Set while a program is forced: nothing is looked for until it's released
+ */
+static gboolean _forced;
 
 static void _set_active(const int progi, const pid_t pid)
 {
 	if (progi == -1) {
 		if (state.progi != -1) {
-			g_debug("active program exited");
+			log_debug("active program exited");
 		}
 	} else {
 		struct program *prog = g_ptr_array_index(cfg.programs, progi);
-		g_debug("setting active program to %s", prog->name);
+		log_debug("setting active program to %s", prog->name);
 	}
 
 	state_set_prog(progi, pid);
@@ -54,8 +62,8 @@ static gboolean _check_cmd(const char *cmd, const pid_t pid)
 	for (i = 0; i < cfg.programs->len; i++) {
 		prog = g_ptr_array_index(cfg.programs, i);
 
-		for (j = 0; j < prog->cmds->len; j++) {
-			patt = g_ptr_array_index(prog->cmds, j);
+		for (j = 0; prog->cmds[j] != NULL; j++) {
+			patt = prog->cmds[j];
 			if (strstr(cmd, patt) != NULL) {
 				_set_active(i, pid);
 				return TRUE;
@@ -77,8 +85,8 @@ static gboolean _check_exec(const char *exe, const pid_t pid)
 	for (i = 0; i < cfg.programs->len; i++) {
 		prog = g_ptr_array_index(cfg.programs, i);
 
-		for (j = 0; j < prog->exes->len; j++) {
-			patt = g_ptr_array_index(prog->exes, j);
+		for (j = 0; prog->exes[j] != NULL; j++) {
+			patt = prog->exes[j];
 
 			if (*patt == '/') {
 				match = g_strcmp0(exe, patt) == 0;
@@ -105,8 +113,12 @@ static void _check_active(void)
 	gboolean ok;
 	char *contents;
 	const char *path;
+	guint64 pids = 0;
 	gboolean running = FALSE;
 	GString *buff = g_string_new("");
+	gint64 start = g_get_monotonic_time();
+
+	TRACE(proc__scan__start);
 
 	dir = g_dir_open("/proc", 0, NULL);
 	while ((path = g_dir_read_name(dir))) {
@@ -117,6 +129,8 @@ static void _check_active(void)
 			continue;
 		}
 
+		pids++;
+
 		g_string_printf(buff, "/proc/%d/cmdline", pid);
 		ok = g_file_get_contents(buff->str, &contents, NULL, NULL);
 		if (ok && _check_cmd(contents, pid)) {
@@ -145,12 +159,20 @@ static void _check_active(void)
 	g_free(contents);
 	g_string_free(buff, TRUE);
 	g_dir_close(dir);
+
+	metrics_add(&metrics.proc_pids, pids);
+	metrics_observe(&metrics.proc_scan, g_get_monotonic_time() - start);
+	TRACE2(proc__scan__done, pids, state.progi);
 }
 
 void proc_on_poll_tick()
 {
 	int err;
 
+	if (_forced) {
+		return;
+	}
+
 	if (state.progi == -1) {
 		_check_active();
 	} else {
@@ -163,5 +185,41 @@ void proc_on_poll_tick()
 
 void proc_on_config_updated()
 {
+	if (_forced) {
+		// Unless it's gone from the config
+		if (state.progi != -1) {
+			return;
+		}
+
+		_forced = FALSE;
+	}
+
 	_check_active();
 }
+
+void proc_force(int progi)
+{
+	gboolean was_forced = _forced;
+
+	_forced = progi != -1;
+
+	if (progi == -1) {
+		if (was_forced) {
+			_set_active(-1, -1);
+			_check_active();
+		}
+
+		return;
+	}
+
+	if (state.progi != -1 && state.progi != progi) {
+		_set_active(-1, -1);
+	}
+
+	_set_active(progi, 0);
+}
+
+gboolean proc_forced()
+{
+	return _forced;
+}
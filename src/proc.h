@@ -17,6 +17,7 @@
  */
 
 #pragma once
+#include <glib.h>
 
 /**
  * Check to see if the program exited
@@ -27,3 +28,14 @@ void proc_on_poll_tick(void);
  * Config was updated. Check to see if anything changed.
  */
 void proc_on_config_updated(void);
+
+/**
+ * Act as if program `progi` were running, with pid 0, until told otherwise;
+ * -1 goes back to looking for programs
+ */
+void proc_force(int progi);
+
+/**
+ * If the running program was forced
+ */
+gboolean proc_forced(void);
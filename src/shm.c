@@ -0,0 +1,65 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "shm.h"
+
+void* shm_publish(
+	const char *path,
+	int mode,
+	gsize size,
+	void (*init)(void *mem))
+{
+	int fd;
+	int err;
+	void *mem;
+	char *tmp = g_strdup_printf("%s.XXXXXX", path);
+
+	fd = g_mkstemp_full(tmp, O_RDWR | O_CLOEXEC, mode);
+	if (fd == -1) {
+		g_error("failed to create %s: %s", tmp, strerror(errno));
+	}
+
+	err = ftruncate(fd, size);
+	if (err == -1) {
+		g_error("failed to size %s: %s", tmp, strerror(errno));
+	}
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		g_error("failed to map %s: %s", tmp, strerror(errno));
+	}
+
+	close(fd);
+	init(mem);
+
+	err = rename(tmp, path);
+	if (err == -1) {
+		g_error("failed to move %s to %s: %s", tmp, path, strerror(errno));
+	}
+
+	g_free(tmp);
+
+	return mem;
+}
@@ -0,0 +1,77 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "config.h"
+#include "shm.h"
+#include "state.h"
+#include "status.h"
+#include "usb.h"
+
+static struct status_page *_page;
+
+static void _publish(void)
+{
+	guint32 seq;
+	struct program *prog = NULL;
+
+	if (_page == NULL) {
+		return;
+	}
+
+	if (state.progi != -1) {
+		prog = g_ptr_array_index(cfg.programs, state.progi);
+	}
+
+	seq = _page->seq;
+	__atomic_store_n(&_page->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	_page->progi = state.progi;
+	_page->pid = state.prog_pid;
+	_page->layout = state.layout;
+	_page->layouts = prog == NULL ? 0 : prog->layouts_len;
+	_page->backlight = prog == NULL ? backlight_off : cfg.usb.backlight;
+	_page->connected = usb_connected();
+	g_strlcpy(_page->name, prog == NULL ? "" : prog->name, STATUS_NAME_MAX);
+
+	__atomic_store_n(&_page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void _init(void *mem)
+{
+	_page = mem;
+	_page->magic = STATUS_MAGIC;
+	_page->version = STATUS_VERSION;
+	_publish();
+}
+
+void status_init(const char *path)
+{
+	shm_publish(path, 0644, sizeof(*_page), _init);
+}
+
+void status_on_state_changed(void)
+{
+	_publish();
+}
+
+void status_on_device_changed(void)
+{
+	_publish();
+}
@@ -0,0 +1,120 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+#include <string.h>
+
+#define STATUS_MAGIC 0x4c545354
+
+/**
+ * Bumped whenever the page changes in a way readers would notice
+ */
+#define STATUS_VERSION 1
+
+#define STATUS_NAME_MAX 64
+
+/**
+ * How long status_read() waits on a page that's being changed before giving
+ * up, in us. Updates take well under a microsecond, but the daemon can be
+ * preempted partway through one; waiting this long means it most likely died.
+ */
+#define STATUS_READ_TIMEOUT 100000
+
+/**
+ * What's at the start of the status file. It's only ever written by the
+ * daemon, which bumps `seq` to odd before changing anything and back to even
+ * after, so readers copy it out with status_read() and never have to talk to
+ * the daemon at all.
+ */
+struct status_page {
+	guint32 magic;
+	guint32 version;
+	guint32 seq;
+
+	/**
+	 * Running program's index in the config and its pid (0 when forced by
+	 * the control socket), or -1 for both if none
+	 */
+	gint32 progi;
+	gint32 pid;
+
+	guint32 layout;
+	guint32 layouts;
+
+	/**
+	 * enum usb_backlight the device is showing
+	 */
+	guint32 backlight;
+
+	guint8 connected;
+	guint8 pad[3];
+
+	/**
+	 * Running program's name, NUL-terminated and cut short if it has to be
+	 */
+	char name[STATUS_NAME_MAX];
+};
+
+/**
+ * Take a consistent copy of a mapped status page. Returns FALSE if it's not
+ * a page this understands, or if it was still being changed after
+ * STATUS_READ_TIMEOUT; check that lintartarus is still running before trying
+ * again.
+ */
+static inline gboolean status_read(
+	const struct status_page *page,
+	struct status_page *out)
+{
+	guint32 seq;
+	gint64 deadline = 0;
+
+	while (TRUE) {
+		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+
+		if (!(seq & 1)) {
+			memcpy(out, page, sizeof(*out));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+			if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+				return out->magic == STATUS_MAGIC &&
+					out->version == STATUS_VERSION;
+			}
+		} else if (deadline == 0) {
+			// Only looks at the clock once there's something to wait on
+			deadline = g_get_monotonic_time() + STATUS_READ_TIMEOUT;
+		} else if (g_get_monotonic_time() >= deadline) {
+			return FALSE;
+		}
+	}
+}
+
+/**
+ * Publish the status page at `path`
+ */
+void status_init(const char *path);
+
+/**
+ * Update the page with the current state
+ */
+void status_on_state_changed(void);
+
+/**
+ * The device came or went
+ */
+void status_on_device_changed(void);
@@ -0,0 +1,71 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "keys.h"
+#include "shm.h"
+#include "state.h"
+#include "tap.h"
+
+static struct tap_ring *_ring;
+
+static void _init(void *mem)
+{
+	struct tap_ring *ring = mem;
+
+	ring->magic = TAP_MAGIC;
+	ring->version = TAP_VERSION;
+	ring->size = TAP_RECS;
+}
+
+void tap_init(const char *path)
+{
+	// Every key press goes through here, so it's for nobody else to see
+	_ring = shm_publish(path, 0600, sizeof(*_ring), _init);
+}
+
+void tap_write(
+	gint64 when,
+	int key,
+	int code,
+	int value,
+	const struct combo *combo)
+{
+	guint64 i;
+	struct tap_rec *rec;
+
+	if (_ring == NULL) {
+		return;
+	}
+
+	i = _ring->head;
+	rec = _ring->recs + (i & (TAP_RECS - 1));
+
+	__atomic_store_n(&rec->seq, 2 * i + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	rec->time = when;
+	rec->key = key;
+	rec->code = code;
+	rec->value = value;
+	rec->combo = combo == NULL ? 0 : keys_combo_hash(combo);
+	rec->layout = state.layout;
+
+	__atomic_store_n(&rec->seq, 2 * (i + 1), __ATOMIC_RELEASE);
+	__atomic_store_n(&_ring->head, i + 1, __ATOMIC_RELEASE);
+}
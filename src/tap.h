@@ -0,0 +1,163 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <glib.h>
+#include <string.h>
+
+#define TAP_MAGIC 0x4c544150
+
+/**
+ * Bumped whenever the ring changes in a way readers would notice
+ */
+#define TAP_VERSION 1
+
+/**
+ * Records in the ring; a power of 2
+ */
+#define TAP_RECS 4096
+
+/**
+ * One key event from the Tartarus and what it was mapped to
+ */
+struct tap_rec {
+	/**
+	 * 2 * (index + 1) once written; odd while being written
+	 */
+	guint64 seq;
+
+	/**
+	 * When the kernel saw it, in us on the monotonic clock
+	 */
+	gint64 time;
+
+	/**
+	 * Key on the device (see keys_get_dev_name()), or -1 if it's not one
+	 * that's mapped
+	 */
+	gint16 key;
+
+	/**
+	 * Key code the device sent
+	 */
+	guint16 code;
+
+	/**
+	 * 1 for press, 0 for release, 2 for repeat
+	 */
+	gint32 value;
+
+	/**
+	 * keys_combo_hash() of what it was mapped to, 0 if nothing
+	 */
+	guint32 combo;
+
+	guint32 layout;
+};
+
+/**
+ * What's in the tap file. There's one writer, the daemon, which never waits
+ * for anyone: readers keep their own position and use tap_read(), and any
+ * that fall more than TAP_RECS behind lose what was overwritten.
+ */
+struct tap_ring {
+	guint32 magic;
+	guint32 version;
+
+	/**
+	 * TAP_RECS
+	 */
+	guint32 size;
+
+	guint32 pad;
+
+	/**
+	 * Records written since the ring was created. Start reading here to
+	 * get only what comes next.
+	 */
+	guint64 head;
+
+	guint8 pad2[40];
+
+	struct tap_rec recs[TAP_RECS];
+};
+
+/**
+ * Copy the record at `*pos` into `out` and move on to the next one, or
+ * return FALSE if there isn't one yet. Records that were overwritten before
+ * they could be read are skipped and counted in `*lost`. It never waits on
+ * the writer, so it returns even if lintartarus died partway through one.
+ */
+static inline gboolean tap_read(
+	const struct tap_ring *ring,
+	guint64 *pos,
+	struct tap_rec *out,
+	guint64 *lost)
+{
+	guint64 seq;
+	guint64 head;
+	const struct tap_rec *rec;
+
+	// Every pass either returns or moves `*pos` on
+	while (TRUE) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (*pos >= head) {
+			return FALSE;
+		}
+
+		if (head - *pos > TAP_RECS) {
+			*lost += head - TAP_RECS - *pos;
+			*pos = head - TAP_RECS;
+		}
+
+		rec = ring->recs + (*pos & (TAP_RECS - 1));
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == 2 * (*pos + 1)) {
+			memcpy(out, rec, sizeof(*out));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+			if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq) {
+				(*pos)++;
+				return TRUE;
+			}
+		}
+
+		// The head only passes a record once it's written, so anything else
+		// means it's being (or has been) overwritten: it's gone either way
+		(*lost)++;
+		(*pos)++;
+	}
+}
+
+struct combo;
+
+/**
+ * Publish the tap at `path`
+ */
+void tap_init(const char *path);
+
+/**
+ * Append an event to the tap, if there is one
+ */
+void tap_write(
+	gint64 when,
+	int key,
+	int code,
+	int value,
+	const struct combo *combo);
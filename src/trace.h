@@ -0,0 +1,65 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * Static tracepoints for perf, bpftrace and friends. With <sys/sdt.h>
+ * (systemtap-sdt-dev, systemtap-sdt-devel) around at build time, each one is
+ * a single nop in the code plus a note describing where to find its
+ * arguments; without it, they're nothing at all. Arguments must be integers
+ * or pointers (cast arrays to pointers: sdt.h takes the sizeof of each), and
+ * cheap: they're computed whether anything is tracing or not.
+ *
+ * Everything is under the "lintartarus" provider; see the README for a list.
+ */
+
+#ifdef __has_include
+#	if __has_include(<sys/sdt.h>)
+#		include <sys/sdt.h>
+#		define HAVE_SDT 1
+#	endif
+#endif
+
+#ifdef HAVE_SDT
+
+#define TRACE(name) \
+	DTRACE_PROBE(lintartarus, name)
+#define TRACE1(name, a) \
+	DTRACE_PROBE1(lintartarus, name, a)
+#define TRACE2(name, a, b) \
+	DTRACE_PROBE2(lintartarus, name, a, b)
+#define TRACE3(name, a, b, c) \
+	DTRACE_PROBE3(lintartarus, name, a, b, c)
+#define TRACE4(name, a, b, c, d) \
+	DTRACE_PROBE4(lintartarus, name, a, b, c, d)
+
+#else
+
+#define TRACE(name) \
+	do { } while (0)
+#define TRACE1(name, a) \
+	do { (void)(a); } while (0)
+#define TRACE2(name, a, b) \
+	do { (void)(a); (void)(b); } while (0)
+#define TRACE3(name, a, b, c) \
+	do { (void)(a); (void)(b); (void)(c); } while (0)
+#define TRACE4(name, a, b, c, d) \
+	do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+
+#endif
@@ -25,12 +25,13 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
-#include "callbacks.h"
 #include "const.h"
+#include "input.h"
 #include "keys.h"
-#include "layout.h"
 #include "poll.h"
+#include "trace.h"
 #include "uinput.h"
 
 #define INPUT_DIR "/dev/input"
@@ -77,7 +78,7 @@ static void _send_syn(void)
 	}
 }
 
-static void _handle_code(int code, int value)
+void uinput_send(int code, int value)
 {
 	int err;
 	struct input_event ev = {
@@ -86,82 +87,22 @@ static void _handle_code(int code, int value)
 		.code = code,
 	};
 
-	if (code < 0) {
-		layout_handle_internal(code);
-	} else {
-		err = write(_out, &ev, sizeof(ev));
-		if (err != sizeof(ev)) {
-			g_error("failed to send key code %d: %s", code, strerror(errno));
-		}
-
-		_send_syn();
-	}
-}
-
-static void _event(int fd)
-{
-	guint i;
-	guint j;
-	ssize_t err;
-	GArray *seq;
-	struct input_event ev;
-	const GPtrArray *combo;
-
-	err = read(fd, &ev, sizeof(ev));
+	err = write(_out, &ev, sizeof(ev));
 	if (err != sizeof(ev)) {
-		if (err != -1) {
-			g_critical("did not get complete input event: "
-				"%" G_GSSIZE_FORMAT " != %" G_GSSIZE_FORMAT,
-				err,
-				sizeof(ev));
-		}
-
-		return;
+		g_error("failed to send key code %d: %s", code, strerror(errno));
 	}
 
-	if (ev.type != EV_KEY) {
-		return;
-	}
-
-	combo = layout_translate(ev.code);
-	if (combo == NULL) {
-		return;
-	}
-
-	g_debug("got combo");
-
-	/*
-	 * If there's only 1 combo, fire it in step with the key press from the
-	 * device. If there's more than 1, fire the combo and ignore keyup.
-	 */
-	if (combo->len == 1) {
-		seq = g_ptr_array_index(combo, 0);
-		for (i = 0; i < seq->len; i++) {
-			_handle_code(g_array_index(seq, int, i), ev.value);
-		}
-	} else if (ev.value == 1) {
-		for (i = 0; i < combo->len; i++) {
-			seq = g_ptr_array_index(combo, i);
-
-			// Send key down
-			for (j = 0; j < seq->len; j++) {
-				_handle_code(g_array_index(seq, int, i), 1);
-			}
-
-			// Send key up
-			for (j = 0; j < seq->len; j++) {
-				_handle_code(g_array_index(seq, int, i), 0);
-			}
-		}
-	}
+	_send_syn();
+	TRACE2(uinput__write, code, value);
 }
 
-static void _sync_devs(int fd)
+static void _sync_devs(int fd, void *nothing G_GNUC_UNUSED)
 {
 	int err;
 	GDir *dir;
 	const char *path;
 	char ifdbuf[1024];
+	int clk = CLOCK_MONOTONIC;
 	struct input_id info;
 	GString *buff = g_string_new("");
 
@@ -201,7 +142,13 @@ static void _sync_devs(int fd)
 			goto end;
 		}
 
-		poll_mod(fd, _event, TRUE, FALSE);
+		// So that event times line up with g_get_monotonic_time()
+		err = ioctl(fd, EVIOCSCLOCKID, &clk);
+		if (err == -1) {
+			goto end;
+		}
+
+		poll_mod(fd, "input", input_read, NULL, prio_input, TRUE, FALSE);
 		g_array_append_val(_fds, fd);
 		continue;
 
@@ -302,6 +249,12 @@ void uinput_init(void)
 			strerror(errno));
 	}
 
-	poll_mod(ifd, _sync_devs, TRUE, FALSE);
-	_sync_devs(ifd);
+	poll_mod(ifd,
+		"input scan",
+		_sync_devs,
+		NULL,
+		prio_housekeeping,
+		TRUE,
+		FALSE);
+	_sync_devs(ifd, NULL);
 }
@@ -25,6 +25,6 @@
 void uinput_init(void);
 
 /**
- * Execute the given series of keys
+ * Press (1), release (0) or repeat (2) a key on the output keyboard
  */
-void uinput_send(GPtrArray *combo);
+void uinput_send(int code, int value);
@@ -24,8 +24,13 @@
 #include <string.h>
 #include "config.h"
 #include "const.h"
+#include "effects.h"
+#include "log.h"
+#include "metrics.h"
 #include "poll.h"
 #include "state.h"
+#include "status.h"
+#include "trace.h"
 #include "usb.h"
 
 #define bmREQUEST_OUT \
@@ -40,19 +45,116 @@
 
 #define TIMEOUT 1000
 
+/**
+ * Bounds on how long to wait between attempts to reopen a lost device, in ms
+ */
+#define RECONNECT_MIN 250
+#define RECONNECT_MAX 60000
+
+/**
+ * Index of the light-level command in cmdv
+ */
+#define LEVEL_CMD 3
+
+/**
+ * The checksum at ARG2I covers everything from here up to it
+ */
+#define CRC_START 2
+
+/**
+ * A run of control transfers pushing a single state to the device
+ */
+struct sync_job {
+	/**
+	 * The transfer currently in flight
+	 */
+	struct libusb_transfer *xfer;
+
+	/**
+	 * First command in cmdv to send, and how many to send. Each command is
+	 * written out and then read back, so that's 2 steps per command.
+	 */
+	int first;
+	int steps;
+
+	/**
+	 * Which step is in flight
+	 */
+	int step;
+
+	/**
+	 * When the job was started on the poll clock, for measuring transfer
+	 * cost
+	 */
+	gint64 started;
+
+	/**
+	 * If the device was closed while this job was running. The job then owns
+	 * the handle and closes it once the cancelled transfer comes back.
+	 */
+	gboolean orphaned;
+
+	/**
+	 * Commands built from the state when the job started
+	 */
+	unsigned char cmdv[CMDS_MAX][CMD_LEN];
+
+	/**
+	 * Setup packet + data for the transfer in flight
+	 */
+	unsigned char buf[LIBUSB_CONTROL_SETUP_SIZE + CMD_LEN];
+};
+
 static gboolean _should_have_dev;
 static libusb_device_handle *_devh;
 
+/**
+ * The only sync allowed in flight
+ */
+static struct sync_job *_job;
+
+/**
+ * State changed while _job was running; sync the latest state once it's done
+ */
+static gboolean _dirty;
+
+/**
+ * Average time a single control transfer takes, in us
+ */
+static guint _xfer_cost;
+
+/**
+ * Timer driving reconnect attempts
+ */
+static struct poll_timer *_reconnect_timer;
+
+/**
+ * Delay to use for the next reconnect attempt, before jitter
+ */
+static guint _backoff;
+
+static unsigned char _crc(const unsigned char *cmd)
+{
+	int i;
+	unsigned char crc = 0;
+
+	for (i = CRC_START; i < ARG2I; i++) {
+		crc ^= cmd[i];
+	}
+
+	return crc;
+}
+
 static void _build_cmds(unsigned char cmdv[CMDS_MAX][CMD_LEN])
 {
 	int i;
-	int backlight;
+	int pulse;
 
 	for (i = 0; i < 3; i++) {
 		memcpy(cmdv[i], layout_cmds[i], CMD_LEN);
 	}
 
-	memcpy(cmdv[3], light_level_cmd, CMD_LEN);
+	memcpy(cmdv[LEVEL_CMD], light_level_cmd, CMD_LEN);
 	memcpy(cmdv[4], pulsate_cmd, CMD_LEN);
 
 	cmdv[0][ARG1I] = layout_vals[state.layout].a.a;
@@ -62,123 +164,289 @@ static void _build_cmds(unsigned char cmdv[CMDS_MAX][CMD_LEN])
 	cmdv[2][ARG1I] = layout_vals[state.layout].c.a;
 	cmdv[2][ARG2I] = layout_vals[state.layout].c.b;
 
-	if (state.progi == -1) {
-		cmdv[3][ARG1I] = light_levels[backlight_off].a;
-		cmdv[3][ARG2I] = light_levels[backlight_off].b;
+	// Any level works, so long as the checksum matches
+	cmdv[LEVEL_CMD][ARG1I] = effects_get_level();
+	cmdv[LEVEL_CMD][ARG2I] = _crc(cmdv[LEVEL_CMD]);
 
-		cmdv[4][ARG1I] = pulsate_vals[FALSE].a;
-		cmdv[4][ARG2I] = pulsate_vals[FALSE].b;
-	} else {
-		backlight = cfg.usb.backlight == backlight_pulse;
-		cmdv[4][ARG1I] = pulsate_vals[backlight].a;
-		cmdv[4][ARG2I] = pulsate_vals[backlight].b;
-
-		backlight = cfg.usb.backlight == backlight_pulse ?
-			backlight_off :
-			cfg.usb.backlight;
-		cmdv[3][ARG1I] = light_levels[backlight].a;
-		cmdv[3][ARG2I] = light_levels[backlight].b;
-	}
+	pulse = state.progi != -1 && cfg.usb.backlight == backlight_pulse;
+	cmdv[4][ARG1I] = pulsate_vals[pulse].a;
+	cmdv[4][ARG2I] = pulsate_vals[pulse].b;
 }
 
-static void _sync(void)
+static void _job_free(struct sync_job *job)
 {
-	int i;
-	int err;
-	struct libusb_config_descriptor *dcfg;
-	unsigned char cmdv[CMDS_MAX][CMD_LEN];
-	int ok = 0;
+	libusb_free_transfer(job->xfer);
+	g_free(job);
+}
+
+static void _release(libusb_device_handle *devh)
+{
+	// With auto-detach on, this also gives the interface back to the kernel
+	libusb_release_interface(devh, wINDEX);
+	libusb_close(devh);
+}
 
+static void _close(void)
+{
 	if (_devh == NULL) {
 		return;
 	}
 
-	err = libusb_get_config_descriptor(libusb_get_device(_devh), 0, &dcfg);
-	if (err != LIBUSB_SUCCESS) {
-		usb_perror(err, "failed to fetch device config");
-		goto out;
+	_dirty = FALSE;
+
+	if (_job != NULL) {
+		_job->orphaned = TRUE;
+		libusb_cancel_transfer(_job->xfer);
+		_job = NULL;
+	} else {
+		_release(_devh);
 	}
 
-	for (i = 0; i < dcfg->bNumInterfaces; i++) {
-		int iface = dcfg->interface[i].altsetting->bInterfaceNumber;
-		if (!libusb_kernel_driver_active(_devh, iface)) {
-			continue;
-		}
+	_devh = NULL;
+	status_on_device_changed();
+}
 
-		err = libusb_detach_kernel_driver(_devh, iface);
-		if (err != LIBUSB_SUCCESS) {
-			usb_perror(err, "failed to detach kernel driver");
-			goto out;
-		}
-	}
+/**
+ * Take ownership of only the lighting interface. The keyboard interfaces
+ * (and their evdev nodes) are never touched, so syncing doesn't drop input.
+ */
+static void _claim(libusb_device_handle *devh)
+{
+	int err;
 
-	err = libusb_set_configuration(_devh, dcfg->bConfigurationValue);
-	if (err != LIBUSB_SUCCESS) {
-		usb_perror(err, "failed to set device configuration");
-		goto out;
+	_devh = devh;
+
+	err = libusb_set_auto_detach_kernel_driver(_devh, 1);
+	if (err != LIBUSB_SUCCESS && err != LIBUSB_ERROR_NOT_SUPPORTED) {
+		usb_perror(err, "failed to enable kernel driver auto-detach");
 	}
 
 	err = libusb_claim_interface(_devh, wINDEX);
 	if (err != LIBUSB_SUCCESS) {
 		usb_perror(err, "failed to claim interface %d", wINDEX);
-		goto out;
+		libusb_close(_devh);
+		_devh = NULL;
+		return;
 	}
 
-	_build_cmds(cmdv);
-	for (i = 0; i < CMDS_MAX; i++) {
-		err = libusb_control_transfer(_devh,
+	status_on_device_changed();
+}
+
+static void _reconnect_reset(void)
+{
+	_backoff = RECONNECT_MIN;
+	poll_timer_cancel(_reconnect_timer);
+}
+
+/**
+ * Schedule another attempt at opening the device. Each failure doubles the
+ * wait (up to RECONNECT_MAX), and the actual wait is randomized over the upper
+ * half of that so that a flaky device doesn't get hit in lockstep.
+ */
+static void _reconnect_schedule(void)
+{
+	guint delay;
+
+	if (!_should_have_dev || _devh != NULL) {
+		return;
+	}
+
+	delay = _backoff / 2 + g_random_int_range(0, _backoff / 2 + 1);
+	_backoff = MIN(_backoff * 2, RECONNECT_MAX);
+
+	log_debug("retrying usb device in %ums", delay);
+	poll_timer_arm(_reconnect_timer, delay);
+}
+
+static void _fail(void)
+{
+	metrics_add(&metrics.usb_failures, 1);
+	_close();
+	_reconnect_schedule();
+}
+
+static void _sync_start(int first, int cmds);
+static void _xfer_done(struct libusb_transfer *xfer);
+
+static gboolean _submit(struct sync_job *job)
+{
+	int err;
+	int i = job->first + job->step / 2;
+	unsigned char *data = job->buf + LIBUSB_CONTROL_SETUP_SIZE;
+
+	if (job->step % 2 == 0) {
+		libusb_fill_control_setup(job->buf,
 			bmREQUEST_OUT,
 			LIBUSB_REQUEST_SET_CONFIGURATION,
 			wVALUE,
 			wINDEX,
-			cmdv[i], CMD_LEN,
-			TIMEOUT);
-		if (err < LIBUSB_SUCCESS) {
-			usb_perror(err, "out control transfer failed %d", err);
-			goto out;
-		}
-
+			CMD_LEN);
+		memcpy(data, job->cmdv[i], CMD_LEN);
+	} else {
 		// I'm not sure this is necessary, but the Windows util does it for
 		// some reason
-		err = libusb_control_transfer(_devh,
+		libusb_fill_control_setup(job->buf,
 			bmREQUEST_IN,
 			LIBUSB_REQUEST_CLEAR_FEATURE,
 			wVALUE,
 			wINDEX,
-			cmdv[i], CMD_LEN,
-			TIMEOUT);
-		if (err < LIBUSB_SUCCESS) {
-			usb_perror(err, "in control transfer failed");
-			goto out;
+			CMD_LEN);
+	}
+
+	// Transfer length comes from the setup packet, so fill this in after it
+	libusb_fill_control_transfer(job->xfer,
+		_devh,
+		job->buf,
+		_xfer_done,
+		job,
+		TIMEOUT);
+
+	TRACE2(usb__xfer__start, job->step, job->first + job->step / 2);
+	err = libusb_submit_transfer(job->xfer);
+	if (err != LIBUSB_SUCCESS) {
+		usb_perror(err, "failed to submit control transfer %d", job->step);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void _xfer_done(struct libusb_transfer *xfer)
+{
+	gint64 took;
+	struct sync_job *job = xfer->user_data;
+
+	if (job->orphaned) {
+		_release(xfer->dev_handle);
+		_job_free(job);
+		return;
+	}
+
+	TRACE2(usb__xfer__done, job->step, xfer->status);
+
+	if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		g_critical("%s control transfer failed: status %d",
+			job->step % 2 == 0 ? "out" : "in",
+			xfer->status);
+		goto fail;
+	}
+
+	job->step++;
+	if (job->step < job->steps) {
+		if (!_submit(job)) {
+			goto fail;
 		}
+
+		return;
 	}
 
-	ok = 1;
+	took = poll_now() - job->started;
+	_xfer_cost = (_xfer_cost * 3 + took / job->steps) / 4;
+	metrics_observe(&metrics.usb_sync, took);
+	TRACE2(usb__sync__done, job->steps / 2, took);
 
-out:
-	libusb_release_interface(_devh, wINDEX);
+	// The device works: the next time it goes away is a fresh start
+	_backoff = RECONNECT_MIN;
+	_job = NULL;
+	_job_free(job);
 
-	for (i = 0; i < dcfg->bNumInterfaces; i++) {
-		libusb_attach_kernel_driver(_devh,
-			dcfg->interface[i].altsetting->bInterfaceNumber);
+	// Everything that happened while this job ran collapses into one sync
+	if (_dirty) {
+		_sync_start(0, CMDS_MAX);
 	}
 
-	libusb_free_config_descriptor(dcfg);
+	return;
 
-	if (!ok) {
-		libusb_close(_devh);
-		_devh = NULL;
+fail:
+	TRACE1(usb__sync__fail, job->step);
+	_job = NULL;
+	_job_free(job);
+	_fail();
+}
+
+/**
+ * Send `cmds` commands from the current state, starting at `first`
+ */
+static void _sync_start(int first, int cmds)
+{
+	struct sync_job *job = g_malloc0(sizeof(*job));
+
+	// A full sync covers anything that was waiting
+	if (cmds == CMDS_MAX) {
+		_dirty = FALSE;
+	}
+
+	job->first = first;
+	job->steps = cmds * 2;
+	job->started = poll_now();
+	metrics_add(&metrics.usb_syncs, 1);
+	TRACE2(usb__sync__start, first, cmds);
+	job->xfer = libusb_alloc_transfer(0);
+	_build_cmds(job->cmdv);
+	_job = job;
+	if (!_submit(job)) {
+		_job = NULL;
+		_job_free(job);
+		_fail();
+	}
+}
+
+/**
+ * Push the current state to the device. At most one sync is ever in flight;
+ * anything requested while one is running is coalesced into a single
+ * follow-up sync of whatever the state is when it finishes.
+ */
+static void _sync(void)
+{
+	if (_devh == NULL) {
+		return;
+	}
+
+	if (_job != NULL) {
+		_dirty = TRUE;
+		return;
 	}
+
+	_sync_start(0, CMDS_MAX);
 }
 
-static void _poll_cb(int fd G_GNUC_UNUSED)
+static void _reconnect(void *nothing G_GNUC_UNUSED)
+{
+	libusb_device_handle *devh;
+
+	if (!_should_have_dev || _devh != NULL) {
+		return;
+	}
+
+	devh = libusb_open_device_with_vid_pid(NULL, VENDOR, PRODUCT);
+	if (devh != NULL) {
+		_claim(devh);
+	}
+
+	if (_devh == NULL) {
+		_reconnect_schedule();
+		return;
+	}
+
+	// The backoff stands until a sync goes through: a device that opens fine
+	// but fails every transfer is no better than one that won't open
+	_sync();
+}
+
+static void _poll_cb(int fd G_GNUC_UNUSED, void *nothing G_GNUC_UNUSED)
 {
 	libusb_handle_events_completed(NULL, NULL);
 }
 
 static void _fd_added(int fd, short events, void *nothing G_GNUC_UNUSED)
 {
-	poll_mod(fd, _poll_cb, events & POLLIN, events & POLLOUT);
+	poll_mod(fd,
+		"usb",
+		_poll_cb,
+		NULL,
+		prio_usb,
+		events & POLLIN,
+		events & POLLOUT);
 }
 
 static void _fd_removed(int fd, void *nothing G_GNUC_UNUSED)
@@ -193,23 +461,32 @@ static int _hotplug(
 	void *user_data G_GNUC_UNUSED)
 {
 	int err;
+	libusb_device_handle *devh;
 
-	libusb_close(_devh);
-	_devh = NULL;
+	_close();
 	_should_have_dev = FALSE;
 
+	// Whatever happened to the last device, this is a fresh start
+	_reconnect_reset();
+
 	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
-		g_debug("new usb device detected");
+		log_debug("new usb device detected");
 
 		_should_have_dev = TRUE;
-		err = libusb_open(dev, &_devh);
+		err = libusb_open(dev, &devh);
 		if (err != 0) {
 			usb_perror(err, "failed to open USB device");
+		} else {
+			_claim(devh);
+		}
+
+		if (_devh == NULL) {
+			_reconnect_schedule();
 		} else {
 			_sync();
 		}
 	} else {
-		g_debug("usb device removed");
+		log_debug("usb device removed");
 	}
 
 	return 0;
@@ -236,6 +513,9 @@ void usb_init()
 
 	free(fds);
 
+	_backoff = RECONNECT_MIN;
+	_reconnect_timer = poll_timer_new(_reconnect, NULL);
+
 	libusb_set_pollfd_notifiers(NULL, _fd_added, _fd_removed, NULL);
 	libusb_hotplug_register_callback(NULL,
 		LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
@@ -250,11 +530,30 @@ void usb_on_state_changed()
 	_sync();
 }
 
-void usb_on_poll_tick()
+gboolean usb_sync_level(void)
 {
-	if (_should_have_dev && _devh == NULL) {
-		_devh = libusb_open_device_with_vid_pid(NULL, VENDOR, PRODUCT);
+	if (_devh == NULL) {
+		return TRUE;
+	}
+
+	if (_job != NULL) {
+		return FALSE;
 	}
+
+	// _build_cmds() asks effects for the level
+	_sync_start(LEVEL_CMD, 1);
+
+	return TRUE;
+}
+
+gboolean usb_connected(void)
+{
+	return _devh != NULL;
+}
+
+guint usb_get_transfer_cost(void)
+{
+	return _xfer_cost;
 }
 
 void usb_perror(int err, const char *format, ...)
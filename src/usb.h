@@ -41,9 +41,21 @@ void usb_init(void);
 void usb_on_state_changed(void);
 
 /**
- * Just check USB state
+ * Push only the backlight level to the device, as given by
+ * effects_get_level(). Returns FALSE if the device is busy and the caller
+ * should try again later.
  */
-void usb_on_poll_tick(void);
+gboolean usb_sync_level(void);
+
+/**
+ * If the device is open
+ */
+gboolean usb_connected(void);
+
+/**
+ * Average time a single control transfer takes, in us
+ */
+guint usb_get_transfer_cost(void);
 
 /**
  * Print a USB error to stderr
@@ -0,0 +1,400 @@
+/*
+ * lintartarus: key mapping and light control for the Razer Tartarus on Linux
+ * Copyright (C) 2015 Andrew Stone <a@stoney.io>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Generates src/keys_table.h: every key name lintartarus knows, from the
+ * kernel's KEY_* codes and src/keys.txt, with a perfect hash for looking
+ * names up and a flat array for going from codes back to names.
+ *
+ * The hash is hash-and-displace: a name's bucket comes from keys_hash() with
+ * seed 0, and each bucket gets a seed of its own that puts all of its names
+ * into free slots. Looking a name up is then two hashes and one compare.
+ *
+ * BTN_* codes are left out on purpose: registering them with uinput makes
+ * the virtual keyboard look like a mouse or joystick to everything else.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "keys_hash.h"
+
+#define NAME_MAX_LEN 64
+#define MAX_KEYS 2048
+#define MAX_SEED 65535
+
+struct key {
+	char name[NAME_MAX_LEN];
+	int code;
+};
+
+/**
+ * Every name, in the order they were found: keys.txt first
+ */
+static struct key _keys[MAX_KEYS];
+static unsigned _keys_len;
+
+/**
+ * Every KEY_* in the kernel header, with its full name
+ */
+static struct key _defs[MAX_KEYS];
+static unsigned _defs_len;
+
+static void _die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "keys_gen: %s%s\n", msg, arg);
+	exit(1);
+}
+
+static const struct key* _find(struct key *keys, unsigned len, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		if (strcasecmp(keys[i].name, name) == 0) {
+			return keys + i;
+		}
+	}
+
+	return NULL;
+}
+
+static void _add(struct key *keys, unsigned *len, const char *name, int code)
+{
+	unsigned i;
+
+	if (strlen(name) >= NAME_MAX_LEN) {
+		_die("name too long: ", name);
+	}
+
+	// First name wins
+	if (_find(keys, *len, name) != NULL) {
+		return;
+	}
+
+	if (*len == MAX_KEYS) {
+		_die("too many keys", "");
+	}
+
+	for (i = 0; name[i] != '\0'; i++) {
+		keys[*len].name[i] = (name[i] >= 'a' && name[i] <= 'z') ?
+			name[i] - ('a' - 'A') :
+			name[i];
+	}
+
+	keys[*len].name[i] = '\0';
+	keys[*len].code = code;
+	(*len)++;
+}
+
+/**
+ * A code, or a KEY_* that's already been defined
+ */
+static int _value(const char *val, int *code)
+{
+	char *end;
+	const struct key *def;
+
+	if (strncmp(val, "KEY_", 4) == 0) {
+		def = _find(_defs, _defs_len, val);
+		if (def == NULL) {
+			return 0;
+		}
+
+		*code = def->code;
+		return 1;
+	}
+
+	*code = strtol(val, &end, 0);
+	return *val != '\0' && *end == '\0';
+}
+
+static FILE* _open(const char *path)
+{
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) {
+		_die("failed to open ", path);
+	}
+
+	return f;
+}
+
+static void _read_kernel(const char *path)
+{
+	int code;
+	char line[512];
+	char name[NAME_MAX_LEN];
+	char val[NAME_MAX_LEN];
+	FILE *f = _open(path);
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "#define %63s %63s", name, val) != 2 ||
+			strncmp(name, "KEY_", 4) != 0 ||
+			strcmp(name, "KEY_RESERVED") == 0 ||
+			strcmp(name, "KEY_MIN_INTERESTING") == 0 ||
+			strcmp(name, "KEY_MAX") == 0 ||
+			strcmp(name, "KEY_CNT") == 0 ||
+			!_value(val, &code)) {
+			continue;
+		}
+
+		_add(_defs, &_defs_len, name, code);
+	}
+
+	fclose(f);
+
+	if (_defs_len == 0) {
+		_die("no KEY_* codes found in ", path);
+	}
+}
+
+static void _read_names(const char *path)
+{
+	int code;
+	char line[512];
+	char name[NAME_MAX_LEN];
+	char val[NAME_MAX_LEN];
+	FILE *f = _open(path);
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		int n = sscanf(line, "%63s %63s", name, val);
+
+		if (n <= 0 || name[0] == '#') {
+			continue;
+		}
+
+		if (n != 2 || !_value(val, &code)) {
+			_die("bad line in key names: ", line);
+		}
+
+		_add(_keys, &_keys_len, name, code);
+	}
+
+	fclose(f);
+}
+
+/**
+ * Find a seed for each bucket such that every name lands in its own slot.
+ * Returns 0 if there isn't one with this many slots.
+ */
+static int _place(unsigned nslots, unsigned nbuckets, int *slots, unsigned *seeds)
+{
+	unsigned i;
+	unsigned j;
+	unsigned b;
+	unsigned seed;
+	unsigned *sizes = calloc(nbuckets, sizeof(*sizes));
+	unsigned *order = calloc(nbuckets, sizeof(*order));
+	unsigned *bucket = calloc(_keys_len, sizeof(*bucket));
+	unsigned *tmp = calloc(_keys_len, sizeof(*tmp));
+	int ok = 1;
+
+	for (i = 0; i < nslots; i++) {
+		slots[i] = -1;
+	}
+
+	for (i = 0; i < _keys_len; i++) {
+		bucket[i] = keys_hash(_keys[i].name, 0) % nbuckets;
+		sizes[bucket[i]]++;
+	}
+
+	// Biggest buckets first, while there's the most room
+	for (i = 0; i < nbuckets; i++) {
+		order[i] = i;
+	}
+
+	for (i = 1; i < nbuckets; i++) {
+		for (j = i; j > 0 && sizes[order[j - 1]] < sizes[order[j]]; j--) {
+			unsigned t = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = t;
+		}
+	}
+
+	for (i = 0; ok && i < nbuckets; i++) {
+		b = order[i];
+		seeds[b] = 0;
+
+		if (sizes[b] == 0) {
+			continue;
+		}
+
+		for (seed = 0; seed <= MAX_SEED; seed++) {
+			unsigned n = 0;
+			int fits = 1;
+
+			for (j = 0; fits && j < _keys_len; j++) {
+				unsigned k;
+				unsigned s;
+
+				if (bucket[j] != b) {
+					continue;
+				}
+
+				s = keys_hash(_keys[j].name, seed) % nslots;
+				fits = slots[s] == -1;
+
+				for (k = 0; fits && k < n; k++) {
+					fits = tmp[k] != s;
+				}
+
+				tmp[n++] = s;
+			}
+
+			if (fits) {
+				break;
+			}
+		}
+
+		if (seed > MAX_SEED) {
+			ok = 0;
+			break;
+		}
+
+		seeds[b] = seed;
+		for (j = 0; j < _keys_len; j++) {
+			if (bucket[j] == b) {
+				slots[keys_hash(_keys[j].name, seed) % nslots] = j;
+			}
+		}
+	}
+
+	free(sizes);
+	free(order);
+	free(bucket);
+	free(tmp);
+
+	return ok;
+}
+
+static void _print_str(const char *s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			putchar('\\');
+		}
+
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+int main(int argc, char **argv)
+{
+	unsigned i;
+	int code;
+	int min = 0;
+	int max = 0;
+	unsigned nslots;
+	unsigned nbuckets;
+	int *slots;
+	unsigned *seeds;
+	const char **names;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s input-event-codes.h keys.txt\n", argv[0]);
+		return 1;
+	}
+
+	_read_kernel(argv[1]);
+	_read_names(argv[2]);
+
+	for (i = 0; i < _defs_len; i++) {
+		_add(_keys, &_keys_len, _defs[i].name + 4, _defs[i].code);
+	}
+
+	nbuckets = (_keys_len / 4) + 1;
+	nslots = _keys_len + (_keys_len / 4) + 1;
+	slots = calloc(_keys_len * 2, sizeof(*slots));
+	seeds = calloc(nbuckets, sizeof(*seeds));
+
+	while (!_place(nslots, nbuckets, slots, seeds)) {
+		if (++nslots == _keys_len * 2) {
+			_die("failed to find a perfect hash", "");
+		}
+	}
+
+	for (i = 0; i < _keys_len; i++) {
+		min = _keys[i].code < min ? _keys[i].code : min;
+		max = _keys[i].code > max ? _keys[i].code : max;
+	}
+
+	names = calloc(max - min + 1, sizeof(*names));
+	for (i = 0; i < _keys_len; i++) {
+		if (names[_keys[i].code - min] == NULL) {
+			names[_keys[i].code - min] = _keys[i].name;
+		}
+	}
+
+	printf("/*\n"
+		" * Generated by tools/keys_gen from %s and %s.\n"
+		" * Don't edit.\n"
+		" */\n\n",
+		argv[1],
+		argv[2]);
+
+	printf("#define KEYS_SLOTS %u\n", nslots);
+	printf("#define KEYS_BUCKETS %u\n", nbuckets);
+	printf("#define KEYS_CODE_MIN %d\n", min);
+	printf("#define KEYS_CODE_MAX %d\n\n", max);
+
+	printf("struct _slot {\n"
+		"\tconst char *name;\n"
+		"\tint code;\n"
+		"};\n\n");
+
+	printf("static const struct _slot _slots[KEYS_SLOTS] = {\n");
+	for (i = 0; i < nslots; i++) {
+		if (slots[i] == -1) {
+			printf("\t{ NULL, 0 },\n");
+		} else {
+			printf("\t{ ");
+			_print_str(_keys[slots[i]].name);
+			printf(", %d },\n", _keys[slots[i]].code);
+		}
+	}
+	printf("};\n\n");
+
+	printf("static const guint16 _seeds[KEYS_BUCKETS] = {\n");
+	for (i = 0; i < nbuckets; i++) {
+		printf("%s%u,%s",
+			i % 12 == 0 ? "\t" : "",
+			seeds[i],
+			i % 12 == 11 || i + 1 == nbuckets ? "\n" : " ");
+	}
+	printf("};\n\n");
+
+	printf("static const char * const _names[KEYS_CODE_MAX - KEYS_CODE_MIN + 1] = {\n");
+	for (code = min; code <= max; code++) {
+		if (names[code - min] != NULL) {
+			printf("\t[%d - KEYS_CODE_MIN] = ", code);
+			_print_str(names[code - min]);
+			printf(",\n");
+		}
+	}
+	printf("};\n");
+
+	free(slots);
+	free(seeds);
+	free(names);
+
+	return 0;
+}